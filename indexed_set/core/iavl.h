@@ -2,12 +2,21 @@
 #define __base2_core_iavl__
 
 #include <inttypes.h>
+#include <atomic>
 #include <functional>
 #include <exception>
 #include <limits>
 #include <tuple>
 #include <iostream>
 #include <chrono>
+#include <iterator>
+#include <vector>
+#include <numeric>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <typeinfo>
 
 //#define AVLTREE_UNITTEST
 #define CHECKED_BUILD
@@ -42,19 +51,107 @@ namespace indexed
 
 	*/
 
-	template <typename Tu, typename Tc = std::less<Tu>>
-	struct _AvlTree : protected _Growable<>
+	/*
+		Order in which nodes are placed in memory by relayout:
+			InOrder		- sorted order, good for scans
+			BreadthFirst	- level by level, top levels of the tree share few cache lines
+			VanEmdeBoas	- recursive blocks of subtrees, cache-oblivious, good for descents at any cache size
+	*/
+	enum struct Layout : uint8_t
+	{
+		InOrder = 1, BreadthFirst = 2, VanEmdeBoas = 3
+	};
+
+
+	/*
+		Header of the file where the tree is stored, the node buffer follows it byte to byte,
+		so the file can be mapped into memory and used as is
+	*/
+	struct _StoreHeader
+	{
+		char		magic[8];
+		uint32_t	version;
+		uint32_t	nodeSize;
+		uint64_t	typeHash;
+
+		uint64_t	used;		//bytes of the node buffer in use
+		int64_t		root, first, last;
+
+		uint32_t	count;
+		uint32_t	offsetSize;	//bytes per node reference
+
+		static constexpr char		MAGIC[8] = { 'i', 'd', 'x', '.', 's', 'e', 't', 0 };
+		static constexpr uint32_t	VERSION = 2;
+	};
+
+	static_assert(sizeof(_StoreHeader) == 64, "Header keeps the node buffer aligned");
+
+
+	/*
+		Runs fn(0) ... fn(Count - 1) on Count threads at once (the calling thread takes fn(0)), and rethrows
+		the first exception after all of them are done
+	*/
+	template <typename Fn>
+	void _InParallel(uint32_t Count, Fn&& fn)
+	{
+		std::exception_ptr err;
+		std::mutex errLock;
+
+		auto run = [&](uint32_t i)
+			{
+				try
+				{
+					fn(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> g(errLock);
+					if (!err)
+						err = std::current_exception();
+				}
+			};
+
+		std::vector<std::thread> pool;
+		for (uint32_t i = 1; i < Count; ++i)
+		{
+			pool.emplace_back(run, i);
+		}
+
+		run(0);
+
+		for (auto& t : pool)
+		{
+			t.join();
+		}
+
+		if (err)
+			std::rethrow_exception(err);
+	}
+
+
+	/* node buffer of the tree, its length is 64-bit only when offsets are */
+	template <typename Tt>
+	using _TreeBuffer = _Growable<1024, 16, typename Tt::backend, Tt::growth_percent,
+		std::conditional_t<(sizeof(typename Tt::offset) > sizeof(uint32_t)), uint64_t, uint32_t>>;
+
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = default_traits>
+	struct _AvlTree : protected _TreeBuffer<Tt>
 	{
-		using _Node = typename inode<Tu, Tc>;
+		using _Node = typename inode<Tu, Tc, Tt>;
 		using _Iter = typename _Node::iterator;
+		using _RIter = typename _Node::reverse_iterator;
 
 		static constexpr size_t Nsize() { return sizeof(_Node); }
 
-		using _Base = _Growable<>;
+		using _Base = _TreeBuffer<Tt>;
+		using u8 = typename _Base::u8;
+		using u32 = typename _Base::u32;
+		using ulen = typename _Base::ulen;
+		using off = typename _Node::off;
 
 
 		//Construction
-		_AvlTree() {}
+		_AvlTree(const Tc& cmp = Tc()) : _Cmp(cmp) {}
 		_AvlTree(const _AvlTree&) = default;
 		_AvlTree(_AvlTree&&) = default;
 		_AvlTree& operator=(const _AvlTree&) = delete;
@@ -69,187 +166,1720 @@ namespace indexed
 		inline _Node* N0() { return (_Node*)_Base::_Head(); }
 		inline _Node* Nptr(off o) { return (_Node*)(_Base::_Head() + o); }
 		inline _Node* NSafePtr(off o) { return o ? (_Node*)(_Base::_Head() + o) : nullptr; }
+		inline const _Node* NSafePtr(off o) const { return o ? (const _Node*)(_Base::_Head() + o) : nullptr; }
 		inline Tu* Tptr(off o) { return &(Nptr(o)->payload); }
 		inline off		Optr(_Node* p) { return (off)((u8*)p - _Base::_Head()); }
 
+		//node in the slot, null if the slot is outside the buffer or not in use
+		inline _Node* NUsedPtr(size_t slotNo) { return (slotNo && (slotNo + 1) * Nsize() <= _Base::len_ && !Nptr((off)(slotNo * Nsize()))->IsEmpty()) ? Nptr((off)(slotNo * Nsize())) : nullptr; }
+
 
 
 		//Iteration
-		_Iter Begin() { return _Iter(NSafePtr(_Root)); }
+		_Iter Begin() { return _Iter::from_node(NSafePtr(_First)); }
 		_Iter End() { return _Iter(); }
 
+		_RIter RBegin() { return _RIter::from_node(NSafePtr(_Last)); }
+		_RIter REnd() { return _RIter(); }
+
+		//smallest and largest elements, cached, so both are O(1)
+		inline _Node* FirstNode() { return NSafePtr(_First); }
+		inline _Node* LastNode() { return NSafePtr(_Last); }
+
 		/*
 			Increases total capacity to store at least ElementCount elements of Tu
 		*/
-		void Reserve(size_t ElementCount) { _Base::_Reserve((u32)((ElementCount + 1) * Nsize())); }
+		void Reserve(size_t ElementCount) { _ReserveNodes(1, ElementCount); }
 
 		/*
 			returns offset of the element and boolean flag meaning that this
 			item really was inserted in this call (true) or already existed (false)
 		*/
-		std::pair<off, bool> Insert(const Tu& v)
-		{
-			_Node* n = nullptr;
-			bool	added = true;
+		std::pair<off, bool> Insert(const Tu& v) { return TryEmplace(v, v); }
+		std::pair<off, bool> Insert(Tu&& v) { return TryEmplace(v, std::move(v)); }
 
+		/*
+			Looks for the key first and constructs payload from args directly in the node only if the key is absent.
+			Constructed payload must be equal to the key.
+		*/
+		template <typename Tk, typename... Ta>
+		std::pair<off, bool> TryEmplace(const Tk& key, Ta&&... args)
+		{
 			if (!_Base::len_)
 			{
 				//first slot (root for deleted chain) is added only once
 				_Base::_PtrAppendZeroBytes((u32)(Nsize()));
 			}
 
-			if (_Root)
+			if (!_Root)
+			{
+				_Root = _First = _Last = Optr(_CreateNode(std::forward<Ta>(args)...));
+				++_Cnt;
+
+				return { _Root, true };
+			}
+
+			return _EmplaceUnder(Nptr(_Root), key, std::forward<Ta>(args)...);
+		}
+
+		/*
+			Insertion, which starts from the hint node instead of the root. The search climbs up via parent links
+			only until it reaches a subtree that can hold the value, so for a hint next to the value in sorted order
+			the search costs O(1) amortized. Invalid or empty hint falls back to regular insertion.
+		*/
+		std::pair<off, bool> InsertHint(off hint, const Tu& v)
+		{
+			_Node* h = (hint > 0 && (ulen)hint < _Base::len_) ? Nptr(hint) : nullptr;
+
+			if (!_Root || !h || h->IsEmpty())
+			{
+				return Insert(v);
+			}
+
+			return _EmplaceUnder(_ClimbFor(h, v), v, v);
+		}
+
+		/*
+			Insertion of the value that is expected to be greater than any other value in the tree,
+			it is attached to the cached rightmost node without any search.
+			Values that are not the new maximum are inserted with the rightmost node as a hint.
+		*/
+		std::pair<off, bool> Append(const Tu& v)
+		{
+			if (!_Root || !_Cmp(Nptr(_Last)->payload, v))
+			{
+				return InsertHint(_Last, v);
+			}
+
+			off parent = _Last;
+			_Node* n = _CreateNode(v);
+
+			_Attach(parent, n, Dir::Right);
+
+			return { Optr(n), true };
+		}
+
+		/*
+			Constructs payload from args directly in the node (reused from deleted chain or appended) and then
+			looks for its place. If equal value is already present, new node is destroyed and given back.
+		*/
+		template <typename... Ta>
+		std::pair<off, bool> Emplace(Ta&&... args)
+		{
+			if (!_Base::len_)
+			{
+				_Base::_PtrAppendZeroBytes((u32)(Nsize()));
+			}
+
+			_Node* n = _CreateNode(std::forward<Ta>(args)...);
+
+			if (!_Root)
+			{
+				_Root = _First = _Last = Optr(n);
+				++_Cnt;
+
+				return { _Root, true };
+			}
+
+			auto [pnode, dir] = Nptr(_Root)->_InsertionPointFor(n->payload, _Cmp);
+
+			if (dir == Dir::None)
+			{
+				_DropNode(n);
+				return { Optr(pnode), false };
+			}
+
+			_Attach(Optr(pnode), n, dir);
+
+			return { Optr(n), true };
+		}
+
+		/*
+			Inserts count values from random-access range, the result of every value is reported through
+			Fr(index, offset, added) in the input order. Among equal values the first one is inserted.
+
+			Buffer grows once up front. Values are visited in sorted order (the batch is sorted only if needed):
+			 - small batch is inserted value by value, each one hinted by the previous one
+			 - big batch is merged with in-order sequence of existing nodes and the whole tree is relinked
+			   into perfectly balanced one in O(n + m), existing nodes keep their slots
+		*/
+		template <typename It, typename Fr>
+		void InsertBatch(It first, size_t count, Fr&& report)
+		{
+			if (!count)
+				return;
+
+			_Base::_CheckWritable();
+
+			if (!_Base::len_)
+			{
+				_Base::_PtrAppendZeroBytes((u32)(Nsize()));
+			}
+
+			//values that are present need no node, so the batch may still fit when the reservation is cut at the offset limit,
+			//_AppendNode refuses nodes past it and the buffer never grows beyond
+			size_t used = _Base::len_ / Nsize();
+			_ReserveNodes(used, std::min(count, _NodeLimit() - used));
+
+			//visiting order, input order is kept if it is already sorted
+			std::vector<u32> ord;
+
+			bool sorted = true;
+			for (size_t i = 1; i < count && sorted; ++i)
+			{
+				sorted = !_Cmp(first[i], first[i - 1]);
+			}
+
+			if (!sorted)
+			{
+				ord.resize(count);
+				std::iota(ord.begin(), ord.end(), 0);
+				std::stable_sort(ord.begin(), ord.end(), [&](u32 a, u32 b) { return _Cmp(first[a], first[b]); });
+			}
+
+			auto Index = [&](size_t k) -> size_t { return sorted ? k : ord[k]; };
+
+			if (count * _Node::_BalancedHeight(_Cnt) < _Cnt)
+			{
+				off hint = 0;
+				for (size_t k = 0; k < count; ++k)
+				{
+					size_t i = Index(k);
+
+					auto [o, added] = InsertHint(hint, first[i]);
+					report(i, o, added);
+
+					hint = o;
+				}
+				return;
+			}
+
+			//merge, all nodes are addressed by offsets, though no reallocation can happen after reservation above
+			std::vector<off> nodes;
+			nodes.reserve(_Cnt + count);
+
+			_Node* e = FirstNode();
+
+			for (size_t k = 0; k < count; ++k)
 			{
-				auto [pnode, dir] = Nptr(_Root)->_InsertionPointFor<Tc>(v);
+				size_t i = Index(k);
+				const Tu& v = first[i];
 
-				if (dir == Dir::None)
+				while (e && _Cmp(e->payload, v))
 				{
-					n = pnode;
-					added = false;
+					nodes.push_back(Optr(e));
+					e = _Node::InorderNextOf(e);
 				}
-				else
+
+				if (e && !_Cmp(v, e->payload))
 				{
-					off parent = Optr(pnode);
-					n = _CreateNode(v);
-					Nptr(parent)->AddChild(n, dir);
+					//equal existing node
+					nodes.push_back(Optr(e));
+					e = _Node::InorderNextOf(e);
+				}
 
-					//any insertion can displace the root node by no more that one click
-					_Root += Nptr(_Root)->parent;
+				if (!nodes.empty() && !_Cmp(Nptr(nodes.back())->payload, v))
+				{
+					report(i, nodes.back(), false);
+				}
+				else
+				{
+					nodes.push_back(Optr(_CreateNode(v)));
+					report(i, nodes.back(), true);
 				}
 			}
-			else
+
+			for (; e; e = _Node::InorderNextOf(e))
+			{
+				nodes.push_back(Optr(e));
+			}
+
+			auto At = [&](u32 k) { return Nptr(nodes[k]); };
+
+			_Cnt = (u32)nodes.size();
+			_Root = Optr(_Node::_LinkSorted(At, 0, _Cnt));
+			_First = nodes.front();
+			_Last = nodes.back();
+		}
+
+		/*
+			Replaces content of the tree with values from the range [first, last), which must be sorted in ascending order.
+
+			Nodes are appended one after another and linked into perfectly balanced tree in one pass, without
+			searching or rotations. Equal neighbours are collapsed, so i-th unique value (counting from zero) always lands in slot i+1.
+		*/
+		template <typename It>
+		void AssignSorted(It first, It last)
+		{
+			Clear();
+
+			if constexpr (std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value)
 			{
-				_Root = Optr(n = _CreateNode(v));
+				Reserve((size_t)std::distance(first, last));
 			}
 
-			if (added)
+			//first slot (root for deleted chain)
+			_Base::_PtrAppendZeroBytes((u32)(Nsize()));
+
+			for (; first != last; ++first)
+			{
+				if (_Cnt)
+				{
+					const Tu& prev = Nptr((off)(_Cnt * Nsize()))->payload;
+
+					ASSERT_THROW(!_Cmp(*first, prev), "Range is not sorted");
+
+					if (!_Cmp(prev, *first))
+						continue;
+				}
+
+				_Node* n = _AppendNode();
+				new (&n->payload) Tu(*first);
+
 				++_Cnt;
+			}
+
+			auto At = [this](u32 i) { return Nptr((off)((i + 1) * Nsize())); };
+
+			if (auto R = _Node::_LinkSorted(At, 0, _Cnt))
+			{
+				_Root = Optr(R);
+				_First = Optr(At(0));
+				_Last = Optr(At(_Cnt - 1));
+			}
+		}
+
+
+		/*
+			Same as above, but i-th value of the sorted range is placed into the given slot slots[i], so the tree
+			can be restored with the same slots as it had before. Slots must be unique and not zero, unused slots
+			below the highest one become deleted nodes.
+		*/
+		template <typename It, typename Is>
+		void AssignSortedAt(It first, size_t count, Is slots)
+		{
+			Clear();
+
+			if (!count)
+				return;
+
+			size_t top = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				ASSERT_THROW(slots[i], "Slot zero is reserved");
+				top = std::max<size_t>(top, slots[i]);
+			}
+
+			if ((uint64_t)(top + 1) * Nsize() > (uint64_t)std::numeric_limits<off>::max())
+				throw std::length_error("Offset type cannot address more nodes");
+
+			_Base::_PtrAppendZeroBytes((ulen)((top + 1) * Nsize()));
+
+			auto At = [&](size_t i) { return Nptr((off)(slots[i] * Nsize())); };
+
+			for (size_t i = 0; i < count; ++i, ++first)
+			{
+				_Node* n = At(i);
+				n->tilt = Dir::None;
+				new (&n->payload) Tu(*first);
+			}
+
+			for (size_t o = top * Nsize(); o; o -= Nsize())
+			{
+				if (Nptr((off)o)->IsEmpty())
+				{
+					_Node::_DecommissionNode(Nptr((off)o), N0());
+				}
+			}
+
+			_Cnt = (u32)count;
+
+			auto R = _Node::_LinkSorted(At, 0, _Cnt);
+
+			_Root = Optr(R);
+			_First = Optr(At(0));
+			_Last = Optr(At(_Cnt - 1));
+		}
+
+
+		/*
+			Replaces content with the values of unsorted random-access range, same as inserting them one by one
+			(among equal values the first one stays), on up to Threads threads:
+			 - chunks of the input are sorted in parallel and merged pairwise, every merge is split among threads
+			 - duplicates are dropped while values are placed in sorted order into the buffer, allocated once
+			 - every worker links perfectly balanced subtree in its own contiguous part of the buffer, nodes above
+			   those subtrees are linked after the workers are done
+		*/
+		template <typename It>
+		void AssignParallel(It first, size_t count, u32 Threads)
+		{
+			Clear();
+
+			if (!count)
+				return;
+
+			Threads = (u32)std::min<size_t>(std::max<u32>(1, Threads), std::max<size_t>(1, count / PARALLEL_MIN));
+
+			std::vector<Tu> a(first, first + count), b;
+			std::vector<size_t> bounds(Threads + 1);
+
+			for (u32 i = 0; i <= Threads; ++i)
+			{
+				bounds[i] = count * i / Threads;
+			}
+
+			_InParallel(Threads, [&](u32 i) { std::stable_sort(a.begin() + bounds[i], a.begin() + bounds[i + 1], _Cmp); });
+
+			if (Threads > 1)
+			{
+				b = a;
+			}
+
+			//every run of 2 * w chunks is merged by as many threads, a run without the pair is copied as is
+			for (u32 w = 1; w < Threads; w *= 2)
+			{
+				_InParallel(Threads, [&](u32 i)
+					{
+						u32 run = i / (2 * w) * (2 * w), parts = std::min(2 * w, Threads - run);
+
+						if (parts <= w)
+						{
+							std::copy(a.begin() + bounds[i], a.begin() + bounds[i + 1], b.begin() + bounds[i]);
+							return;
+						}
+
+						size_t lo = bounds[run], mid = bounds[run + w], hi = bounds[run + parts];
+
+						//k-th part takes the k-th share of the left run, and everything less from the right one
+						auto Split = [&](u32 k) -> std::pair<size_t, size_t>
+							{
+								if (!k)
+									return { lo, mid };
+
+								if (k == parts)
+									return { mid, hi };
+
+								size_t l = lo + (mid - lo) * k / parts;
+								return { l, (size_t)(std::lower_bound(a.begin() + mid, a.begin() + hi, a[l], _Cmp) - a.begin()) };
+							};
+
+						auto [l0, r0] = Split(i - run);
+						auto [l1, r1] = Split(i - run + 1);
+
+						std::merge(a.begin() + l0, a.begin() + l1, a.begin() + r0, a.begin() + r1, b.begin() + lo + (l0 - lo) + (r0 - mid), _Cmp);
+					});
+
+				std::swap(a, b);
+			}
+
+			//unique values of every chunk go to consecutive slots
+			std::vector<size_t> kept(Threads + 1, 0);
+
+			_InParallel(Threads, [&](u32 i)
+				{
+					for (size_t j = bounds[i]; j < bounds[i + 1]; ++j)
+					{
+						kept[i + 1] += (!j || _Cmp(a[j - 1], a[j])) ? 1 : 0;
+					}
+				});
+
+			std::partial_sum(kept.begin(), kept.end(), kept.begin());
+
+			size_t total = kept[Threads];
+
+			if ((uint64_t)(total + 1) * Nsize() > (uint64_t)std::numeric_limits<off>::max())
+				throw std::length_error("Offset type cannot address more nodes");
+
+			_Base::_PtrAppendZeroBytes((ulen)((total + 1) * Nsize()));
+
+			auto At = [this](u32 i) { return Nptr((off)((i + 1) * Nsize())); };
+
+			_InParallel(Threads, [&](u32 i)
+				{
+					size_t o = kept[i];
+
+					for (size_t j = bounds[i]; j < bounds[i + 1]; ++j)
+					{
+						if (!j || _Cmp(a[j - 1], a[j]))
+						{
+							new (&At((u32)o++)->payload) Tu(a[j]);
+						}
+					}
+				});
+
+			_Cnt = (u32)total;
 
-			return { Optr(n), added };
+			_Root = Optr(_LinkParallel(At, 0, _Cnt, Threads));
+			_First = Optr(At(0));
+			_Last = Optr(At(_Cnt - 1));
 		}
 
 
 		inline _Node* Root() { return (_Node*)(_Base::_Head() + _Root); }
 		inline size_t	Size() const { return _Cnt; }
 
+		/* shared file mapping is detached, the file keeps the last state of the tree */
 		void Clear()
+		{
+			_SyncHeader();
+
+			//trivial payloads need no traversal, others are destroyed by a linear scan of the buffer
+			if constexpr (!std::is_trivially_destructible<Tu>::value)
+			{
+				for (size_t o = Nsize(); o < _Base::len_; o += Nsize())
+				{
+					if (!Nptr((off)o)->IsEmpty())
+					{
+						Nptr((off)o)->__DestroyPayload();
+					}
+				}
+			}
+
+			_Root = _First = _Last = 0;
+			_Cnt = 0;
+
+			_Base::_Reset();
+		}
+
+		template <typename Fn>
+		void Foreach(Fn&& cb)
 		{
 			if (auto R = NSafePtr(_Root))
 			{
-				R->DestroyRecursive();
-				_Root = 0;
-				_Cnt = 0;
+				R->Inorder(cb);
 			}
+		}
+
+		/*
+			Walks the node buffer in slot order, from the first to the last node, skipping deleted nodes (holes),
+			so memory is read strictly forward, regardless of the tree order.
+		*/
+		struct _SlotIter
+		{
+			const u8*	head = { nullptr };
+			ulen		o = { 0 };
+			ulen		len = { 0 };
+
+			inline operator bool() const { return o ? true : false; }
+			inline bool operator!=(const _SlotIter& x) const { return o != x.o; }
+
+			_SlotIter& operator++() { o = _NextLive(head, o + Nsize(), len); return *this; }
+
+			const Tu& operator*() const { return ((const _Node*)(head + o))->payload; }
+			const Tu* operator->() const { return &((const _Node*)(head + o))->payload; }
+
+			inline off offset() const { return (off)o; }
+		};
+
+		_SlotIter SlotBegin() { return { _Base::_Head(), _NextLive(_Base::_Head(), Nsize(), _Base::len_), _Base::len_ }; }
+		_SlotIter SlotEnd() { return {}; }
+
+		/*
+			Calls cb(offset, value) for all nodes in use, in slot order. Tilt bytes of SLOT_GROUP nodes are gathered into
+			a bit mask without branches, and only the nodes in use are visited, so dense and sparse runs of the buffer cost about the same per node.
+		*/
+		template <typename Fn>
+		void ForeachSlot(Fn&& cb)
+		{
+			const u8* head = _Base::_Head();
+			const ulen len = _Base::len_, S = (ulen)Nsize();
+
+			if (len <= S)
+				return;
+
+			const u8* tilts = (const u8*)&((const _Node*)head)->tilt;
+
+			ulen o = S;
+
+			for (; o + SLOT_GROUP * S <= len; o += SLOT_GROUP * S)
+			{
+				for (uint32_t m = _LiveMask16(tilts + o, S); m; m &= m - 1)
+				{
+					ulen p = o + _LowestBit(m) * S;
+					cb((off)p, ((const _Node*)(head + p))->payload);
+				}
+			}
+
+			for (; o < len; o += S)
+			{
+				if (!((const _Node*)(head + o))->IsEmpty())
+				{
+					cb((off)o, ((const _Node*)(head + o))->payload);
+				}
+			}
+		}
+
+		/*
+			Splittable part of the in-order sequence: all nodes of the subtree under n, followed by node t, either
+			can be null. Split at the subtree root gives two parts of about the same size, one right after the other:
+			left subtree followed by n, and right subtree followed by t.
+		*/
+		struct _Split
+		{
+			_Node*	n = { nullptr };
+			_Node*	t = { nullptr };
+
+			inline bool empty() const { return !n && !t; }
+			inline bool splittable() const { return n && (n->left || n->right); }
+
+			std::pair<_Split, _Split> split() const { return { { n->NSafeLeft(), n }, { n->NSafeRight(), t } }; }
+
+			/* number of nodes, or the upper bound of it, when nodes are not counted */
+			size_t size() const
+			{
+				size_t k = t ? 1 : 0;
+
+				if constexpr (Tt::counted)
+					return k + _Node::CountOf(n);
+				else
+					return k + (n ? ((size_t)1 << n->Height()) - 1 : 0);
+			}
+
+			/* calls f(value) for every node in order */
+			template <typename Fn>
+			void for_each(Fn&& f) const
+			{
+				if (n)
+				{
+					for (_Node* x = _Node::LeftmostOf(n), *last = _Node::RightmostOf(n); ; x = _Node::InorderNextOf(x))
+					{
+						f(x->payload);
+
+						if (x == last)
+							break;
+					}
+				}
+
+				if (t)
+				{
+					f(t->payload);
+				}
+			}
+		};
+
+		_Split Whole() { return { NSafePtr(_Root), nullptr }; }
+
+		/* splits the largest part while there are fewer than Want of them, returns non-empty parts in order */
+		std::vector<_Split> SplitInto(size_t Want)
+		{
+			std::vector<_Split> parts;
+			if (_Root)
+			{
+				parts.push_back(Whole());
+			}
+
+			while (parts.size() < Want)
+			{
+				size_t best = parts.size(), most = 0;
+
+				for (size_t i = 0; i < parts.size(); ++i)
+				{
+					if (parts[i].splittable() && parts[i].size() > most)
+					{
+						best = i;
+						most = parts[i].size();
+					}
+				}
+
+				if (best == parts.size())
+					break;
+
+				auto [l, r] = parts[best].split();
+
+				parts[best] = l;
+
+				//the rightmost part may end up with nothing
+				if (!r.empty())
+				{
+					parts.insert(parts.begin() + best + 1, r);
+				}
+			}
+
+			return parts;
+		}
+
+		/*
+			Calls f(part index, value) for every value, parts (see SplitInto) are taken by Threads threads one by one,
+			so values of every part are visited in order on one thread
+		*/
+		template <typename Fn>
+		void ForeachParallel(Fn&& f, u32 Threads)
+		{
+			auto parts = SplitInto((size_t)Threads * 4);
+
+			std::atomic<size_t> next = { 0 };
+
+			_InParallel((u32)std::max<size_t>(1, std::min<size_t>(Threads, parts.size())), [&](u32)
+				{
+					for (size_t i; (i = next++) < parts.size(); )
+					{
+						parts[i].for_each([&](const Tu& v) { f(i, v); });
+					}
+				});
+		}
+
+		enum struct _Algebra : uint8_t
+		{
+			Union = 1, Intersection = 2, Difference = 3
+		};
+
+		/*
+			Makes this tree the union, intersection or difference of itself and tree o (which lives in its own buffer).
+
+			Divide and conquer by split and join: the root of o splits this tree, both halves are combined with
+			subtrees of o recursively, and the results are joined back, which takes O(m log(n/m + 1)) for sizes
+			m <= n. Nodes of this tree keep their offsets, values taken from o get new nodes.
+
+			With Threads > 1 both recursive calls of the top levels run at once, they touch disjoint subtrees
+			and share only node allocation, which goes under a lock. Memory is reserved up front.
+		*/
+		void Combine(const _AvlTree& o, _Algebra op, u32 Threads)
+		{
+			if (&o == this)
+			{
+				if (op == _Algebra::Difference)
+					Clear();
+				return;
+			}
+
+			if (!_Root && op != _Algebra::Union)
+				return;
+
+			_Base::_CheckWritable();
+
+			if (op == _Algebra::Union && o._Cnt)
+			{
+				if (!_Base::len_)
+				{
+					_Base::_PtrAppendZeroBytes((u32)(Nsize()));
+				}
+
+				_ReserveNodes(_Base::len_ / Nsize(), o._Cnt);
+			}
+
+			std::mutex lock;
+
+			_Combined x;
+			x.op = op;
+			x.lock = Threads > 1 ? &lock : nullptr;
+
+			for (u32 t = 1; t < Threads; t *= 2)
+			{
+				++x.spawn;
+			}
+
+			_Node* R = NSafePtr(_Root);
+
+			u32 h;
+			R = _Combine(R, R ? R->Height() : 0, o.NSafePtr(o._Root), h, x, 0);
+
+			_Cnt = (u32)((int64_t)_Cnt + x.delta.load());
+
+			_SetRoot(R);
+		}
+
+#ifdef CHECKED_BUILD
+		void __LifeCheck(std::ostream& o)
+		{
+			u32 mi = 0, ma = 0, lcnt = 0, total = 0;
+
+			float tme = 0;
+
+			if (_Root)
+			{
+				Nptr(_Root)->InorderNodes([&](_Node* n, u32 De)
+					{
+						++total;
+						if (0 == n->left && 0 == n->right)
+						{
+
+							if (++lcnt == 1)
+							{
+								mi = ma = De;
+							}
+							else
+							{
+								mi = std::min<uint32_t>(mi, De);
+								ma = std::max<uint32_t>(ma, De);
+							}
+						}
+					});
+
+			}
+
+			o << "allocated memory: " << _Base::_Capacity() << std::endl;
+			o << "   reallocations: " << _Base::Reallocs_ << std::endl;
+
+			o << "     used memory: " << _Base::_Size() << std::endl;
+			o << "total node count: " << total << std::endl;
+			o << "      leaf nodes: " << lcnt << std::endl;
+			o << "  min leaf depth: " << mi << std::endl;
+			o << "  max leaf depth: " << ma << std::endl;
+
+		}
+
+		/*
+			Verifies links, balance, order and subtree sizes (for counted nodes) of the entire tree
+		*/
+		bool __ValidateIntegrity()
+		{
+			u32 total = 0;
+
+			if (auto R = NSafePtr(_Root))
+			{
+				if (R->parent || _CheckSubtree(R, total) < 0)
+					return false;
+
+				_Node* prev = nullptr;
+				for (auto it = Begin(); it; ++it)
+				{
+					if (prev && !_Cmp(prev->payload, it.node()->payload))
+						return false;
+
+					prev = it.node();
+				}
+			}
+
+			return total == _Cnt;
+		}
+
+		/* returns height of the subtree or -1 if any violation is found, total is incremented by subtree size */
+		static int32_t _CheckSubtree(_Node* n, u32& total)
+		{
+			int32_t hl = 0, hr = 0;
+			u32 cnt = 0;
+
+			if (auto L = n->NSafeLeft())
+			{
+				if (L->Nparent() != n || (hl = _CheckSubtree(L, cnt)) < 0)
+					return -1;
+			}
+
+			if (auto R = n->NSafeRight())
+			{
+				if (R->Nparent() != n || (hr = _CheckSubtree(R, cnt)) < 0)
+					return -1;
+			}
+
+			if (n->tilt != (hl == hr ? Dir::None : (hl > hr ? Dir::Left : Dir::Right)) || hl - hr > 1 || hr - hl > 1)
+				return -1;
+
+			++cnt;
+
+			if constexpr (Tt::counted)
+			{
+				if (n->count != cnt)
+					return -1;
+			}
+
+			total += cnt;
+
+			return 1 + std::max(hl, hr);
+		}
+
+#endif
+
+		template <typename Tk>
+		void Erase(const Tk& v)
+		{
+			if (auto Proot = NSafePtr(_Root))
+			{
+				if (auto [pnode, dir] = Proot->_InsertionPointFor(v, _Cmp); dir == Dir::None)
+				{
+					_Remove(pnode);
+				}
+			}
+		}
+		void EraseAtOffset(off o)
+		{
+			if (_Root)
+			{
+				if (auto pnode = NSafePtr(o))
+				{
+					_Remove(pnode);
+				}
+			}
+		}
+
+		/*
+			Erases all values in [lo, hi), returns their number.
+
+			The tree is split at lo and at hi, the middle part is cut off as a whole and the rest is joined back,
+			so there is no rebalancing per value: O(log n) plus one pass over erased nodes, which go to deleted chain at once.
+		*/
+		template <typename Tk>
+		size_t EraseRange(const Tk& lo, const Tk& hi)
+		{
+			_Node* R = NSafePtr(_Root);
+
+			if (!R || !_Cmp(lo, hi))
+				return 0;
+
+			_Base::_CheckWritable();
+
+			_Node* L, * M, * G, * Mid;
+			u32 hl, hm, hg, hmid, h;
+
+			_Node* m = _Node::_Split(R, R->Height(), lo, _Cmp, L, hl, M, hm);
+			_Node* k = _Node::_Split(M, hm, hi, _Cmp, Mid, hmid, G, hg);
+
+			R = k ? _Node::_Join(L, hl, k, G, hg, h) : _Node::_Join2(L, hl, G, hg, h);
+
+			std::vector<_Node*> gone;
+			if (m)
+			{
+				gone.push_back(m);
+			}
+			if (Mid)
+			{
+				Mid->InorderNodes([&](_Node* n, u32) { gone.push_back(n); });
+			}
+
+			_DropNodes(gone);
+
+			_Cnt -= (u32)gone.size();
+			_SetRoot(R);
+
+			return gone.size();
+		}
+
+		/*
+			Erases all values for which pred(value) is true, returns their number.
+
+			Victims are marked in one in-order pass. A few of them are erased one by one, otherwise the survivors are
+			relinked into perfectly balanced tree in O(n), and victims go to deleted chain at once. Survivors keep their slots.
+		*/
+		template <typename Fp>
+		size_t EraseIf(Fp&& pred)
+		{
+			if (!_Root)
+				return 0;
+
+			_Base::_CheckWritable();
+
+			std::vector<off> keep;
+			std::vector<_Node*> gone;
+
+			for (_Node* e = FirstNode(); e; e = _Node::InorderNextOf(e))
+			{
+				if (pred(static_cast<const Tu&>(e->payload)))
+					gone.push_back(e);
+				else
+					keep.push_back(Optr(e));
+			}
+
+			if (gone.size() * _Node::_BalancedHeight(_Cnt) < _Cnt)
+			{
+				for (auto n : gone)
+				{
+					_Remove(n);
+				}
+				return gone.size();
+			}
+
+			auto At = [&](u32 i) { return Nptr(keep[i]); };
+
+			_Cnt = (u32)keep.size();
+			_SetRoot(_Node::_LinkSorted(At, 0, _Cnt));
+
+			_DropNodes(gone);
+
+			return gone.size();
+		}
+
+		/*
+			Looks up count keys and reports offset of every found node (zero if not found) through Fr(index, offset).
+
+			Keys are taken in groups, descents of the group advance in lockstep, one level per round, and every
+			next node is prefetched, so cache misses of different descents overlap instead of going one by one.
+		*/
+		template <typename Tk, typename Fr>
+		void FindBatch(const Tk* keys, size_t count, Fr&& report)
+		{
+			constexpr u32 G = LOOKUP_GROUP;
+
+			_Node* cur[G];
+
+			for (size_t base = 0; base < count; base += G)
+			{
+				u32 g = (u32)std::min<size_t>(G, count - base);
+				u32 active = 0;
+
+				for (u32 i = 0; i < g; ++i)
+				{
+					if ((cur[i] = NSafePtr(_Root)))
+						++active;
+					else
+						report(base + i, (off)0);
+				}
+
+				while (active)
+				{
+					for (u32 i = 0; i < g; ++i)
+					{
+						_Node* n = cur[i];
+						if (!n)
+							continue;
+
+						int c = _Compare3(_Cmp, keys[base + i], n->payload);
+
+						if (c)
+						{
+							n = c < 0 ? n->NSafeLeft() : n->NSafeRight();
+
+							if (n)
+							{
+								_Prefetch(n);
+								cur[i] = n;
+								continue;
+							}
+						}
+
+						report(base + i, c ? (off)0 : Optr(cur[i]));
+						cur[i] = nullptr;
+						--active;
+					}
+				}
+			}
+		}
+
+		/*
+			Same as above for keys given in ascending order: every descent starts from the node where the previous one
+			ended and climbs only as high as the next key requires, so close keys share most of the path
+		*/
+		template <typename Tk, typename Fr>
+		void FindSortedBatch(const Tk* keys, size_t count, Fr&& report)
+		{
+			_Node* h = NSafePtr(_Root);
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (!h)
+				{
+					report(i, (off)0);
+					continue;
+				}
+
+				auto [n, d] = _ClimbFor(h, keys[i])->_InsertionPointFor(keys[i], _Cmp);
+
+				report(i, d == Dir::None ? Optr(n) : (off)0);
+				h = n;
+			}
+		}
+
+		template <typename Tk>
+		_Iter FindNode(const Tk& v)
+		{
+			_Node* Found = nullptr;
+
+			if (auto Proot = NSafePtr(_Root))
+			{
+				if (auto [n, d] = Proot->_InsertionPointFor(v, _Cmp); d == Dir::None)
+				{
+					Found = n;
+				}
+			}
+
+			return _Iter::from_node(Found);
+		}
+
+		/* returns first node that is not less than v, or null */
+		template <typename Tk>
+		_Node* LowerBoundNode(const Tk& v)
+		{
+			_Node* Found = nullptr;
+
+			for (_Node* n = NSafePtr(_Root); n; )
+			{
+				if (_Cmp(n->payload, v))
+				{
+					n = n->NSafeRight();
+				}
+				else
+				{
+					Found = n;
+					n = n->NSafeLeft();
+				}
+			}
+
+			return Found;
+		}
+
+		/* returns first node that is greater than v, or null */
+		template <typename Tk>
+		_Node* UpperBoundNode(const Tk& v)
+		{
+			_Node* Found = nullptr;
+
+			for (_Node* n = NSafePtr(_Root); n; )
+			{
+				if (_Cmp(v, n->payload))
+				{
+					Found = n;
+					n = n->NSafeLeft();
+				}
+				else
+				{
+					n = n->NSafeRight();
+				}
+			}
+
+			return Found;
+		}
+
+		/* returns node which is k-th (zero-based) in sorted order, or null if k is out of range */
+		_Node* NthNode(size_t k)
+		{
+			static_assert(Tt::counted, "Order statistics require counted traits");
+
+			_Node* n = NSafePtr(_Root);
+
+			while (n)
+			{
+				u32 lcnt = _Node::CountOf(n->NSafeLeft());
+
+				if (k < lcnt)
+				{
+					n = n->Nleft();
+				}
+				else if (k == lcnt)
+				{
+					break;
+				}
+				else
+				{
+					k -= lcnt + 1;
+					n = n->NSafeRight();
+				}
+			}
+
+			return n;
+		}
+
+		/* returns number of elements that are less than v */
+		template <typename Tk>
+		size_t Rank(const Tk& v)
+		{
+			static_assert(Tt::counted, "Order statistics require counted traits");
+
+			size_t r = 0;
+			_Node* n = NSafePtr(_Root);
+
+			while (n)
+			{
+				if (_Cmp(n->payload, v))
+				{
+					r += _Node::CountOf(n->NSafeLeft()) + 1;
+					n = n->NSafeRight();
+				}
+				else
+				{
+					n = n->NSafeLeft();
+				}
+			}
+
+			return r;
+		}
+
+		/*
+			Rewrites the buffer, so that active nodes are placed one after another in the requested order,
+			the shape of the tree stays the same. Deleted chain and all holes are dropped.
+
+			Every node changes its offset, which is reported as Fr(old offset, new offset)
+		*/
+		template <typename Fr>
+		void Relayout(Layout l, Fr&& remap)
+		{
+			_Base::_CheckWritable();
+
+			if (!_Root)
+			{
+				Clear();
+				return;
+			}
+
+			std::vector<off> ord;
+			ord.reserve(_Cnt);
+
+			switch (l)
+			{
+			case Layout::InOrder:
+				for (_Node* n = FirstNode(); n; n = _Node::InorderNextOf(n))
+				{
+					ord.push_back(Optr(n));
+				}
+				break;
+
+			case Layout::BreadthFirst:
+				ord.push_back(_Root);
+				for (size_t i = 0; i < ord.size(); ++i)
+				{
+					_Node* n = Nptr(ord[i]);
+
+					if (n->left)
+						ord.push_back(Optr(n->Nleft()));
+					if (n->right)
+						ord.push_back(Optr(n->Nright()));
+				}
+				break;
+
+			default:
+				_VebOrder(Nptr(_Root), Nptr(_Root)->Height(), ord);
+				break;
+			}
+
+			//new index of every node, by its old slot
+			std::vector<u32> pos(_Base::len_ / Nsize(), 0);
+			for (u32 i = 0; i < (u32)ord.size(); ++i)
+			{
+				pos[ord[i] / Nsize()] = i + 1;
+			}
+
+			auto Moved = [&](off o) { return (off)(pos[o / Nsize()] * Nsize()); };
+
+			//nodes are copied aside and written back in new order, relative links are recalculated
+			std::vector<u8> old(_Base::_Head(), _Base::_Head() + _Base::len_);
+			memset(_Base::_Head(), 0, _Base::len_);
+
+			for (off o : ord)
+			{
+				off m = Moved(o);
+				const _Node* src = (const _Node*)(old.data() + o);
+				_Node* dst = Nptr(m);
+
+				memcpy((void*)dst, src, Nsize());
+
+				dst->parent = src->parent ? Moved(o + src->parent) - m : 0;
+				dst->left = src->left ? Moved(o + src->left) - m : 0;
+				dst->right = src->right ? Moved(o + src->right) - m : 0;
+
+				remap(o, m);
+			}
+
+			_Base::len_ = (ulen)((ord.size() + 1) * Nsize());
+
+			_Root = Moved(_Root);
+			_First = Moved(_First);
+			_Last = Moved(_Last);
+		}
+
+		/* writes the header and the node buffer into a file, returns false on i/o error */
+		bool Save(const char* path)
+		{
+			_StoreHeader h;
+			_FillHeader(h);
+
+			std::ofstream f(path, std::ios::binary | std::ios::trunc);
+
+			f.write((const char*)&h, sizeof(h));
+			if (_Base::len_)
+			{
+				f.write((const char*)_Base::_Head(), _Base::len_);
+			}
+
+			return f.good();
+		}
+
+		/*
+			Replaces the content with the tree stored in the file, which is mapped into memory as is: nothing is parsed
+			or copied. Returns false (and keeps current content) if the file is missing or was saved for another type.
+		*/
+		bool OpenMapped(const char* path, MapMode mode)
+		{
+			std::unique_ptr<_FileMap> m(new _FileMap());
+
+			if (!m->Open(path, mode) || m->size < sizeof(_StoreHeader))
+				return false;
+
+			const _StoreHeader h = *(const _StoreHeader*)m->base;
+
+			if (memcmp(h.magic, _StoreHeader::MAGIC, sizeof(h.magic)) || h.version != _StoreHeader::VERSION ||
+				h.nodeSize != Nsize() || h.offsetSize != sizeof(off) || h.typeHash != _TypeHash() ||
+				h.used > m->size - sizeof(_StoreHeader))
+				return false;
+
+			Clear();
+
+			_Base::_AdoptMapping(m.release(), (ulen)sizeof(_StoreHeader), (ulen)h.used);
+
+			_Cnt = h.count;
+			_Root = (off)h.root;
+			_First = (off)h.first;
+			_Last = (off)h.last;
+
+			return true;
+		}
+
+		/*
+			Turns out into read-only view of the current content, which shares memory pages with this tree if the
+			backend can do that, otherwise out gets a plain copy, which is read-only as well
+		*/
+		void SnapshotTo(_AvlTree& out)
+		{
+			out.Clear();
+
+			if (_FileMap* v = _Base::_View())
+			{
+				out._AdoptMapping(v, 0, _Base::len_);
+			}
+			else if (_Base::len_)
+			{
+				out._PtrAppendBytes(_Base::_Head(), _Base::len_);
+			}
+
+			out._SetReadOnly();
+
+			out._Cnt = _Cnt;
+			out._Root = _Root;
+			out._First = _First;
+			out._Last = _Last;
+		}
+
+		/* for shared file mapping, writes current state into the file header and flushes modified pages */
+		void Sync()
+		{
+			if (_SyncHeader())
+			{
+				_Base::_Mapping()->Flush();
+			}
+		}
+
+	protected:
+
+		/* size of the group of lockstep descents in FindBatch */
+		static constexpr u32 LOOKUP_GROUP = 16;
+
+		//nodes, which tilts are tested at once by slot-order scan
+		static constexpr u32 SLOT_GROUP = 16;
+
+		/* offset of the first node in use at offset o or after it, zero if there is none */
+		static ulen _NextLive(const u8* head, ulen o, ulen len)
+		{
+			const ulen S = (ulen)Nsize();
+
+			if (o >= len)
+				return 0;
+
+			const u8* tilts = (const u8*)&((const _Node*)head)->tilt;
+
+			for (; o + SLOT_GROUP * S <= len; o += SLOT_GROUP * S)
+			{
+				if (uint32_t m = _LiveMask16(tilts + o, S))
+					return o + _LowestBit(m) * S;
+			}
+
+			for (; o < len; o += S)
+			{
+				if (!((const _Node*)(head + o))->IsEmpty())
+					return o;
+			}
+
+			return 0;
+		}
+
+		/* state of one Combine */
+		struct _Combined
+		{
+			_Algebra	op = { _Algebra::Union };
+
+			//levels of recursion that run in parallel
+			u32			spawn = { 0 };
+
+			//guards node allocation, when parallel
+			std::mutex*	lock = { nullptr };
+
+			std::atomic<int64_t>	delta = { 0 };
+		};
+
+		/* combines subtree a (of height ha) of this tree with subtree b of the other tree, returns the root and the height */
+		_Node* _Combine(_Node* a, u32 ha, const _Node* b, u32& h, _Combined& x, u32 depth)
+		{
+			if (!b)
+			{
+				if (x.op == _Algebra::Intersection)
+				{
+					_DropSubtree(a, x);
+					a = nullptr;
+					ha = 0;
+				}
+
+				h = ha;
+				return a;
+			}
+
+			if (!a)
+			{
+				h = 0;
+				return x.op == _Algebra::Union ? _CopySubtree(b, h, x) : nullptr;
+			}
+
+			_Node* L, * R;
+			u32 hl, hr;
+			_Node* m = _Node::_Split(a, ha, b->payload, _Cmp, L, hl, R, hr);
+
+			const _Node* bl = b->NSafeLeft(), * br = b->NSafeRight();
+
+			if (depth < x.spawn)
+			{
+				_InParallel(2, [&](u32 i)
+					{
+						if (i)
+							R = _Combine(R, hr, br, hr, x, depth + 1);
+						else
+							L = _Combine(L, hl, bl, hl, x, depth + 1);
+					});
+			}
+			else
+			{
+				L = _Combine(L, hl, bl, hl, x, depth + 1);
+				R = _Combine(R, hr, br, hr, x, depth + 1);
+			}
+
+			if (!m && x.op == _Algebra::Union)
+			{
+				std::unique_lock<std::mutex> g = _Lock(x);
+
+				m = _CreateNode(b->payload);
+				++x.delta;
+			}
+			else if (m && x.op == _Algebra::Difference)
+			{
+				_Drop(m, x);
+				m = nullptr;
+			}
+
+			return m ? _Node::_Join(L, hl, m, R, hr, h) : _Node::_Join2(L, hl, R, hr, h);
+		}
+
+		inline std::unique_lock<std::mutex> _Lock(_Combined& x) { return x.lock ? std::unique_lock<std::mutex>(*x.lock) : std::unique_lock<std::mutex>(); }
+
+		/* destroys the detached node and places it into deleted chain */
+		void _Drop(_Node* n, _Combined& x)
+		{
+			n->__DestroyPayload();
+
+			std::unique_lock<std::mutex> g = _Lock(x);
+
+			_Node::_DecommissionNode(n, N0());
+			--x.delta;
+		}
+
+		void _DropSubtree(_Node* n, _Combined& x)
+		{
+			if (!n)
+				return;
+
+			std::vector<_Node*> all;
+			n->Enumerate([&](_Node* e) { all.push_back(e); });
+
+			std::unique_lock<std::mutex> g = _Lock(x);
+
+			_DropNodes(all);
+			x.delta -= (int64_t)all.size();
+		}
+
+		/* nodes of the subtree in order, the subtree is only read */
+		static void _CollectInorder(const _Node* n, std::vector<const _Node*>& out)
+		{
+			for (; n; n = n->NSafeRight())
+			{
+				_CollectInorder(n->NSafeLeft(), out);
+				out.push_back(n);
+			}
+		}
+
+		/* copies subtree b of the other tree into new nodes of this one, linked into perfectly balanced tree */
+		_Node* _CopySubtree(const _Node* b, u32& h, _Combined& x)
+		{
+			std::vector<const _Node*> src;
+			std::vector<_Node*> dst;
+
+			_CollectInorder(b, src);
+
+			dst.reserve(src.size());
+			{
+				std::unique_lock<std::mutex> g = _Lock(x);
+
+				for (auto e : src)
+				{
+					dst.push_back(_CreateNode(e->payload));
+				}
+			}
+
+			x.delta += (int64_t)dst.size();
+
+			auto At = [&](u32 i) { return dst[i]; };
+
+			h = _Node::_BalancedHeight((u32)dst.size());
+			return _Node::_LinkSorted(At, 0, (u32)dst.size());
+		}
+
+		/* fewest elements worth a thread of their own in AssignParallel */
+		static constexpr size_t PARALLEL_MIN = 64 * 1024;
+
+		/* same as _Node::_LinkSorted, halves of the range are linked on separate threads while there are any */
+		template <typename Fa>
+		static _Node* _LinkParallel(Fa& At, u32 First, u32 Count, u32 Threads)
+		{
+			if (Threads < 2 || Count < PARALLEL_MIN)
+				return _Node::_LinkSorted(At, First, Count);
+
+			u32 nl = (Count - 1) / 2, nr = Count - 1 - nl;
+
+			_Node* L = nullptr;
+			std::thread left([&]() { L = _LinkParallel(At, First, nl, Threads / 2); });
+
+			_Node* R = _LinkParallel(At, First + nl + 1, nr, Threads - Threads / 2);
+
+			left.join();
+
+			return _Node::_JoinSorted(At(First + nl), L, nl, R, nr);
+		}
+
+		/*
+			Climbs up from h via parent links only until it reaches a subtree that can hold v. For h next to v in
+			sorted order that takes O(1) amortized.
+		*/
+		template <typename Tk>
+		_Node* _ClimbFor(_Node* h, const Tk& v)
+		{
+			for (int c = _Compare3(_Cmp, v, h->payload); c; )
+			{
+				//subtree of h is bounded on the side of v by the nearest ancestor, where the path turns
+				Dir side = c < 0 ? Dir::Left : Dir::Right;
+
+				_Node* m = h;
+				while (m->parent && m->Branch() == side)
+				{
+					m = m->Nparent();
+				}
+
+				_Node* b = m->NSafeParent();
+				if (!b)
+					break;
+
+				int cb = _Compare3(_Cmp, v, b->payload);
+
+				//v lies strictly between b and h, so it belongs to the subtree of h
+				if (cb && (cb < 0) != (c < 0))
+					break;
+
+				h = b;
+				c = cb;
+			}
+
+			return h;
+		}
+
+		static uint64_t _TypeHash()
+		{
+			//FNV-1a over the node type name, which covers user type, comparator and traits
+			uint64_t h = 14695981039346656037ull;
+
+			for (const char* p = typeid(_Node).name(); *p; ++p)
+			{
+				h = (h ^ (uint8_t)*p) * 1099511628211ull;
+			}
+
+			return h;
+		}
+
+		void _FillHeader(_StoreHeader& h)
+		{
+			memset(&h, 0, sizeof(h));
+			memcpy(h.magic, _StoreHeader::MAGIC, sizeof(h.magic));
+
+			h.version = _StoreHeader::VERSION;
+			h.nodeSize = (uint32_t)Nsize();
+			h.typeHash = _TypeHash();
+
+			h.used = _Base::len_;
+			h.root = _Root;
+			h.first = _First;
+			h.last = _Last;
+
+			h.count = _Cnt;
+			h.offsetSize = (uint32_t)sizeof(off);
+		}
+
+		/* updates the header of shared file mapping, returns false if there is none */
+		bool _SyncHeader()
+		{
+			auto m = _Base::_Mapping();
+
+			if (!m || m->mode != MapMode::Shared)
+				return false;
+
+			_FillHeader(*(_StoreHeader*)m->base);
+			return true;
+		}
+
+		/* appends nodes of the subtree under n, limited to given number of levels, in van Emde Boas order */
+		void _VebOrder(_Node* n, u32 Levels, std::vector<off>& out)
+		{
+			if (Levels == 1)
+			{
+				out.push_back(Optr(n));
+				return;
+			}
+
+			u32 top = Levels / 2;
+
+			_VebOrder(n, top, out);
+			_VebBottom(n, top, Levels - top, out);
+		}
+
+		/* lays out, left to right, all subtrees which hang Depth levels below n */
+		void _VebBottom(_Node* n, u32 Depth, u32 Levels, std::vector<off>& out)
+		{
+			if (!n)
+				return;
+
+			if (!Depth)
+			{
+				_VebOrder(n, Levels, out);
+			}
+			else
+			{
+				_VebBottom(n->NSafeLeft(), Depth - 1, Levels, out);
+				_VebBottom(n->NSafeRight(), Depth - 1, Levels, out);
+			}
+		}
+
+		/* searches for the key under start node (which must be in the tree) and creates the node if the key is absent */
+		template <typename Tk, typename... Ta>
+		std::pair<off, bool> _EmplaceUnder(_Node* start, const Tk& key, Ta&&... args)
+		{
+			auto [pnode, dir] = start->_InsertionPointFor(key, _Cmp);
+
+			if (dir == Dir::None)
+			{
+				return { Optr(pnode), false };
+			}
+
+			off parent = Optr(pnode);
+			_Node* n = _CreateNode(std::forward<Ta>(args)...);
+
+			ASSERT_THROW(0 == _Compare3(_Cmp, key, n->payload), "Emplaced value does not match the key");
+
+			_Attach(parent, n, dir);
+
+			return { Optr(n), true };
+		}
+
+		/* removes active node from the tree and places it into deleted chain */
+		void _Remove(_Node* pnode)
+		{
+			if (pnode->IsEmpty())
+				return;
+
+			_Base::_CheckWritable();
+
+			//cached ends are moved while the node is still linked
+			if (Optr(pnode) == _First)
+			{
+				auto next = _Node::InorderNextOf(pnode);
+				_First = next ? Optr(next) : 0;
+			}
+			if (Optr(pnode) == _Last)
+			{
+				auto prev = _Node::InorderPrevOf(pnode);
+				_Last = prev ? Optr(prev) : 0;
+			}
+
+			_Node* Proot = Nptr(_Root);
+
+			if (_Node::_EraseNode(Proot, pnode))
+			{
+				--_Cnt;
+
+				_Root = Proot ? Optr(Proot) : 0;
+
+				_Node::_DecommissionNode(pnode, N0());
+			}
+		}
 
-			_Base::_Reset();
+		/* makes detached subtree the whole tree, cached ends follow */
+		inline void _SetRoot(_Node* R)
+		{
+			_Root = R ? Optr(R) : 0;
+			_First = R ? Optr(_Node::LeftmostOf(R)) : 0;
+			_Last = R ? Optr(_Node::RightmostOf(R)) : 0;
 		}
 
-		void Foreach(std::function<void(const Tu&)> cb)
+		/* destroys payloads of the nodes, which are not linked anymore, and moves them into deleted chain in one piece */
+		void _DropNodes(std::vector<_Node*>& nodes)
 		{
-			if (auto R = NSafePtr(_Root))
+			for (auto n : nodes)
 			{
-				R->Inorder(cb);
+				n->__DestroyPayload();
 			}
+
+			auto At = [&](size_t i) { return nodes[i]; };
+			_Node::_DecommissionNodes(At, nodes.size(), N0());
 		}
 
-#ifdef CHECKED_BUILD
-		void __LifeCheck(std::ostream& o)
+		/* links just created node as a child of parent, updates cached ends, root and count */
+		inline void _Attach(off parent, _Node* n, Dir dir)
 		{
-			u32 mi = 0, ma = 0, lcnt = 0, total = 0;
+			Nptr(parent)->AddChild(n, dir);
 
-			float tme = 0;
-
-			if (_Root)
+			if (parent == (dir == Dir::Left ? _First : _Last))
 			{
-				Nptr(_Root)->Enumerate([&](_Node* n)
-					{
-						++total;
-						if (0 == n->left && 0 == n->right)
-						{
-							auto De = n->Depth();
-
-							if (++lcnt == 1)
-							{
-								mi = ma = De;
-							}
-							else
-							{
-								mi = std::min<uint32_t>(mi, De);
-								ma = std::max<uint32_t>(ma, De);
-							}
-						}
-					});
-
+				(dir == Dir::Left ? _First : _Last) = Optr(n);
 			}
 
-			o << "allocated memory: " << _Base::_Capacity() << std::endl;
-			o << "   reallocations: " << _Base::Reallocs_ << std::endl;
-
-			o << "     used memory: " << _Base::_Size() << std::endl;
-			o << "total node count: " << total << std::endl;
-			o << "      leaf nodes: " << lcnt << std::endl;
-			o << "  min leaf depth: " << mi << std::endl;
-			o << "  max leaf depth: " << ma << std::endl;
+			//any insertion can displace the root node by no more that one click
+			_Root += Nptr(_Root)->parent;
 
+			++_Cnt;
 		}
 
-#endif
-
-		void Erase(const Tu& v)
+		/* destroys node that was created, but never linked; the last node of the buffer is simply cut off */
+		inline void _DropNode(_Node* n)
 		{
-			if (auto Proot = NSafePtr(_Root))
-			{
-				if (auto [pnode, dir] = Proot->_InsertionPointFor<Tc>(v); dir == Dir::None)
-				{
-					if (_Node::_EraseNode(Proot, pnode))
-					{
-						--_Cnt;
+			n->__DestroyPayload();
 
-						_Root = Proot ? Optr(Proot) : 0;
-
-						_Node::_DecommissionNode(pnode, N0());
-					}
-				}
+			if (Optr(n) + Nsize() == _Base::len_)
+			{
+				memset(n, 0, Nsize());
+				_Base::len_ -= (u32)Nsize();
 			}
-		}
-		void EraseAtOffset(off o)
-		{
-			if (auto Proot = NSafePtr(_Root))
+			else
 			{
-				if (auto pnode = NSafePtr(o))
-				{
-					if (_Node::_EraseNode(Proot, pnode))
-					{
-						--_Cnt;
-
-						_Root = Proot ? Optr(Proot) : 0;
-
-						_Node::_DecommissionNode(pnode, N0());
-					}
-				}
+				_Node::_DecommissionNode(n, N0());
 			}
 		}
 
-		_Iter FindNode(const Tu& v)
+		/* number of nodes, including the head one, whose offsets fit the offset type */
+		static constexpr size_t _NodeLimit() { return (size_t)std::numeric_limits<off>::max() / Nsize(); }
+
+		/* grows the buffer to hold 'used' nodes and 'count' more, throws when their offsets would not fit the offset type */
+		void _ReserveNodes(size_t used, size_t count)
 		{
-			_Node* Found = nullptr;
+			size_t limit = _NodeLimit();
 
-			if (auto Proot = NSafePtr(_Root))
-			{
-				if (auto [n, d] = Proot->_InsertionPointFor<Tc>(v); d == Dir::None)
-				{
-					Found = n;
-				}
-			}
+			if (count > limit || used > limit - count)
+				throw std::length_error("Offset type cannot address more nodes");
 
-			return _Iter::from_node(Found);
+			_Base::_Reserve((ulen)((used + count) * Nsize()));
 		}
 
-	protected:
+		/* adds blank node at the end of the buffer, throws when its offset would not fit the offset type */
+		inline _Node* _AppendNode()
+		{
+			if ((uint64_t)_Base::len_ + Nsize() > (uint64_t)std::numeric_limits<off>::max())
+				throw std::length_error("Offset type cannot address more nodes");
+
+			return (_Node*)_Base::_PtrAppendZeroBytes((ulen)Nsize());
+		}
 
-		//returns 'deleted' node if present, or appends a new one
-		inline _Node* _CreateNode(const Tu& v)
+		//returns 'deleted' node if present, or appends a new one, payload is constructed from args
+		template <typename... Ta>
+		inline _Node* _CreateNode(Ta&&... args)
 		{
+			_Base::_CheckWritable();
+
 			_Node* n = N0()->NSafeRight();
 			if (n)
 			{
@@ -261,11 +1891,24 @@ namespace indexed
 			}
 			else
 			{
-				n = (_Node*)_Base::_PtrAppendZeroBytes((u32)Nsize());
+				n = _AppendNode();
 				n->tilt = Dir::None;
 			}
 
-			new (n)  Tu(v);
+			if constexpr (Tt::counted)
+			{
+				n->count = 1;
+			}
+
+			//aggregates are brace-initialized, since they have no constructors before C++20
+			if constexpr (std::is_constructible<Tu, Ta&&...>::value)
+			{
+				new (&n->payload)  Tu(std::forward<Ta>(args)...);
+			}
+			else
+			{
+				new (&n->payload)  Tu{ std::forward<Ta>(args)... };
+			}
 
 			return n;
 		}
@@ -273,12 +1916,20 @@ namespace indexed
 	protected:
 		u32		_Cnt = { 0 };
 		off		_Root = { 0 };
+		off		_First = { 0 }, _Last = { 0 };
+
+		//comparator instance, which is used by all searches, so it can carry a state
+		Tc		_Cmp;
 	};
 
 
 
 	typedef uint32_t slot;
 
+	//defined in ifrozen.h
+	template <typename Tu, typename Tc, typename Tt>
+	struct frozen_set;
+
 
 	/*
 		Represents a set, based on AVL tree, where inserted elements can be addressed by slot index or by value.
@@ -286,23 +1937,28 @@ namespace indexed
 		Slot numbers are in [1...N] where N has no relation of actual number of elements in the set.
 		This can happen because slots for 'erased' elements can later be reused to store 'inserted' elements
 
+		Order statistics (nth, rank, count_range) require Tt = counted_traits.
+
 		So, elements in this set can be reached in two ways:
 		1. Binary search 'by value', the same as in std::set
 		2. By slot, indexed way, similar in std::vector
 
 	*/
-	template <typename Tu, typename Tc = std::less<Tu>>
-	struct set : protected _AvlTree<Tu, Tc>
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = default_traits>
+	struct set : protected _AvlTree<Tu, Tc, Tt>
 	{
 		static_assert(std::is_trivially_copyable<Tu>::value);
 
-		using _Base = typename _AvlTree<Tu, Tc>;
-		using iter = typename _AvlTree<Tu, Tc>::_Iter;
+		using _Base = typename _AvlTree<Tu, Tc, Tt>;
+		using iter = typename _AvlTree<Tu, Tc, Tt>::_Iter;
+		using riter = typename _AvlTree<Tu, Tc, Tt>::_RIter;
+
+		using off = typename _Base::off;
 
 		static constexpr slot ToSlot(off o) { return o ? (slot)(size_t(o) / _Base::Nsize()) : 0; }
 
 
-		set(size_t initialCount = 0) { if (initialCount) _Base::Reserve(initialCount); }
+		set(size_t initialCount = 0, const Tc& cmp = Tc()) : _Base(cmp) { if (initialCount) _Base::Reserve(initialCount); }
 
 		set(const set&) = default;
 		set(set&&) = default;
@@ -313,7 +1969,7 @@ namespace indexed
 		inline size_t	size() const { return _Base::Size(); }
 		inline bool		empty() const { return 0 == size() ? true : false; }
 
-		inline void		reserve(size_t count) { _Base::_Reserve((uint32_t)((count+1) * _Base::Nsize())); }
+		inline void		reserve(size_t count) { _Base::Reserve(count); }
 
 		/* returns slot number for specified value and boolean flag, indicating that a given value was actually inserted */
 		std::pair<slot, bool> insert(const Tu& v)
@@ -322,6 +1978,91 @@ namespace indexed
 			return  { ToSlot(o), added };
 		}
 
+		std::pair<slot, bool> insert(Tu&& v)
+		{
+			auto [o, added] = _Base::Insert(std::move(v));
+			return  { ToSlot(o), added };
+		}
+
+		/*
+			Inserts the value, starting the search from the hint slot, which should be close to the value in
+			sorted order (e.g. the slot of previously inserted value for ordered input)
+		*/
+		std::pair<slot, bool> insert(slot hint, const Tu& v)
+		{
+			auto [o, added] = _Base::InsertHint((off)(hint * _Base::Nsize()), v);
+			return  { ToSlot(o), added };
+		}
+
+		/* fast path for monotonic input, the value is expected to be greater than any value in the set */
+		std::pair<slot, bool> append(const Tu& v)
+		{
+			auto [o, added] = _Base::Append(v);
+			return  { ToSlot(o), added };
+		}
+
+		/*
+			Inserts a batch of values from random-access range [first, last), sorted or not, and returns
+			slot and 'inserted' flag for every value in the input order. Buffer grows only once, big batches
+			are merged with the set in one pass.
+		*/
+		template <typename It>
+		std::vector<std::pair<slot, bool>> insert_batch(It first, It last)
+		{
+			std::vector<std::pair<slot, bool>> res((size_t)(last - first));
+
+			_Base::InsertBatch(first, res.size(), [&](size_t i, off o, bool added) { res[i] = { ToSlot(o), added }; });
+
+			return res;
+		}
+
+		/*
+			Constructs the value from args directly in its slot, without temporary copy,
+			if equal value is already present, the constructed one is discarded
+		*/
+		template <typename... Ta>
+		std::pair<slot, bool> emplace(Ta&&... args)
+		{
+			auto [o, added] = _Base::Emplace(std::forward<Ta>(args)...);
+			return  { ToSlot(o), added };
+		}
+
+		/*
+			Constructs the value from args directly in its slot only if the key is not present yet,
+			the constructed value must be equal to the key
+		*/
+		template <typename Tk, typename... Ta>
+		std::pair<slot, bool> try_emplace(const Tk& key, Ta&&... args)
+		{
+			auto [o, added] = _Base::TryEmplace(key, std::forward<Ta>(args)...);
+			return  { ToSlot(o), added };
+		}
+
+		/*
+			Replaces content of the set with the values from sorted range [first, last) in O(n),
+			equal neighbours are collapsed and i-th unique value (counting from zero) is placed into slot i+1
+		*/
+		template <typename It>
+		void assign_sorted(It first, It last) { _Base::AssignSorted(first, last); }
+
+		/*
+			Replaces content of the set with the values from sorted range [first, last), where i-th value is placed
+			into slot slots[i] (unique and not zero), e.g. to restore the set with slots that are kept elsewhere
+		*/
+		template <typename It, typename Is>
+		void assign_sorted_at(It first, It last, Is slots) { _Base::AssignSortedAt(first, (size_t)std::distance(first, last), slots); }
+
+		/*
+			Replaces content of the set with the values of unsorted random-access range [first, last), the same as
+			clear() and insert() of every value would, but on 'threads' threads (0 - one per core): the values are
+			sorted in parallel, and linked into perfectly balanced tree by parallel workers. Slots follow the order.
+		*/
+		template <typename It>
+		void assign_parallel(It first, It last, uint32_t threads = 0)
+		{
+			_Base::AssignParallel(first, (size_t)(last - first), _Threads(threads));
+		}
+
 		/* returns value that's owned by the set, either inserted or existing */
 		std::pair<const Tu&, slot> inserted(const Tu& v)
 		{
@@ -332,6 +2073,16 @@ namespace indexed
 		void erase(const Tu& v) { _Base::Erase(v); }
 		void erase_at(slot pos) { _Base::EraseAtOffset((off)(pos * _Base::Nsize())); }
 
+		/*
+			Erases all values in [lo, hi) at once, by split and join, and returns their number.
+			Slots of erased values go to the deleted chain in one piece, other values keep their slots.
+		*/
+		size_t erase_range(const Tu& lo, const Tu& hi) { return _Base::EraseRange(lo, hi); }
+
+		/* erases all values for which pred(value) is true, in one pass and one rebuild, returns their number */
+		template <typename Fp>
+		size_t erase_if(Fp&& pred) { return _Base::EraseIf(pred); }
+
 		slot operator[](const Tu& v)
 		{
 			auto [o, added] = _Base::Insert(v);
@@ -343,18 +2094,44 @@ namespace indexed
 			return _Base::FindNode(v);
 		}
 
-		slot find_slot(const Tu& v)
+		slot find_slot(const Tu& v) { return _FindSlot(v); }
+
+		/*
+			Batched find_slot: out[i] receives the slot of in[i] or zero. Descents of a group of keys are interleaved
+			to overlap their cache misses, which pays off for big sets and random keys.
+			Tk is Tu or any key type, accepted by transparent comparator.
+		*/
+		template <typename Tk>
+		void find_slots(const Tk* in, size_t count, slot* out)
 		{
-			slot o = 0;
-			if (auto it = _Base::FindNode(v))
-			{
-				o = ToSlot(_Base::Optr(it.node()));
-			}
-			return o;
+			_Base::FindBatch(in, count, [&](size_t i, off o) { out[i] = ToSlot(o); });
+		}
+
+		/* same as find_slots, for keys in ascending order, every search continues from the previous one */
+		template <typename Tk>
+		void find_slots_sorted(const Tk* in, size_t count, slot* out)
+		{
+			_Base::FindSortedBatch(in, count, [&](size_t i, off o) { out[i] = ToSlot(o); });
 		}
 
 
 
+		/*
+			Order statistics, available only for sets with counted traits, all in O(log n)
+		*/
+
+		/* returns iterator of k-th (zero-based) element in sorted order, or 'end' if k >= size() */
+		iter nth(size_t k) { return iter::from_node(_Base::NthNode(k)); }
+
+		/* returns number of elements that are less than v, which is also a sorted position of v, if present */
+		size_t rank(const Tu& v) { return _Base::Rank(v); }
+
+		/* returns number of elements in [lo, hi) */
+		size_t count_range(const Tu& lo, const Tu& hi)
+		{
+			return _Base::_Cmp(lo, hi) ? _Base::Rank(hi) - _Base::Rank(lo) : 0;
+		}
+
 		inline const Tu& at(slot pos)
 		{
 			return *_Base::Tptr((off)(pos * _Base::Nsize()));
@@ -363,10 +2140,200 @@ namespace indexed
 		iter begin() { return _Base::Begin(); }
 		iter end() { return _Base::End(); }
 
+		riter rbegin() { return _Base::RBegin(); }
+		riter rend() { return _Base::REnd(); }
+
+		/* smallest and largest elements, the set must not be empty */
+		inline const Tu& front() { return _Base::FirstNode()->payload; }
+		inline const Tu& back() { return _Base::LastNode()->payload; }
+
+		/* first element that is not less than v */
+		iter lower_bound(const Tu& v) { return iter::from_node(_Base::LowerBoundNode(v)); }
+
+		/* first element that is greater than v */
+		iter upper_bound(const Tu& v) { return iter::from_node(_Base::UpperBoundNode(v)); }
+
+		/* [lower_bound, upper_bound) pair, the range is empty if v is not present */
+		std::pair<iter, iter> equal_range(const Tu& v) { return { lower_bound(v), upper_bound(v) }; }
+
+
+		/*
+			Heterogeneous lookup, same as in std::set: when comparator declares 'is_transparent', any key type it
+			accepts can be used for searching or erasing, without constructing Tu for every probe
+		*/
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		iter find(const Tk& k) { return _Base::FindNode(k); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		slot find_slot(const Tk& k) { return _FindSlot(k); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		void erase(const Tk& k) { _Base::Erase(k); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		size_t erase_range(const Tk& lo, const Tk& hi) { return _Base::EraseRange(lo, hi); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		iter lower_bound(const Tk& k) { return iter::from_node(_Base::LowerBoundNode(k)); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		iter upper_bound(const Tk& k) { return iter::from_node(_Base::UpperBoundNode(k)); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		std::pair<iter, iter> equal_range(const Tk& k) { return { lower_bound(k), upper_bound(k) }; }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		size_t rank(const Tk& k) { return _Base::Rank(k); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		size_t count_range(const Tk& lo, const Tk& hi) { return _Base::_Cmp(lo, hi) ? _Base::Rank(hi) - _Base::Rank(lo) : 0; }
+
+
 
 		void clear() { _Base::Clear(); }
 
-		void foreach(std::function<void(const Tu & v)> f) { _Base::Foreach(f); }
+		/*
+			Persistence: the set is written as a small header followed by the node buffer, and can be opened later
+			by mapping the file into memory, which takes no parsing or copying regardless of the size.
+
+			Read-only mapping throws on any modification, shared mapping writes all changes through to the file
+			(and grows it), copy-on-write mapping keeps changes private. clear() detaches the set from the file.
+		*/
+		bool save(const char* path) { return _Base::Save(path); }
+		bool open_mapped(const char* path, MapMode mode = MapMode::ReadOnly) { return _Base::OpenMapped(path, mode); }
+
+		/* makes the file of shared mapping consistent with the set, without detaching it */
+		void sync() { _Base::Sync(); }
+
+		/*
+			Point-in-time, read-only view of the set, which does not change when the set does.
+
+			With cow_backend the view shares memory pages with the set, and the pages are copied one by one only when
+			the set modifies them afterwards, so a snapshot of any size costs about nothing. Other backends (and sets
+			opened from files) give a plain copy. Either way any modification of the view throws, a copy of the view
+			is a regular, writable set.
+		*/
+		set snapshot()
+		{
+			set out(0, _Base::_Cmp);
+			_Base::SnapshotTo(out);
+			return out;
+		}
+
+		/*
+			Rewrites the node buffer in the given layout to make reads faster, and drops all holes.
+			Every element moves to a new slot, remap(old slot, new slot) is called for each one,
+			so the slots kept outside can be updated.
+		*/
+		template <typename Fm>
+		void optimize_layout(Layout l, Fm&& remap)
+		{
+			_Base::Relayout(l, [&](off from, off to) { remap(ToSlot(from), ToSlot(to)); });
+		}
+
+		/* same as above, returns new slot for every old slot (zero for slots that were not in use) */
+		std::vector<slot> optimize_layout(Layout l = Layout::VanEmdeBoas)
+		{
+			std::vector<slot> table(_Base::_Size() / _Base::Nsize(), 0);
+
+			optimize_layout(l, [&](slot from, slot to) { table[from] = to; });
+
+			return table;
+		}
+
+		template <typename Fn>
+		void foreach(Fn&& f) { _Base::Foreach(f); }
+
+		/*
+			Slot-order access: all values in the order of their slots, not values. The node buffer is read
+			strictly forward and deleted slots are skipped, which is the fastest way to visit every value
+			when the order does not matter. for_each_slot calls f(value, slot).
+		*/
+		struct slot_iter : _Base::_SlotIter
+		{
+			slot_iter(const typename _Base::_SlotIter& it) : _Base::_SlotIter(it) {}
+
+			slot_iter& operator++() { _Base::_SlotIter::operator++(); return *this; }
+
+			inline slot slot_of() const { return ToSlot(this->offset()); }
+		};
+
+		slot_iter slot_begin() { return _Base::SlotBegin(); }
+		slot_iter slot_end() { return _Base::SlotEnd(); }
+
+		template <typename Fn>
+		void for_each_slot(Fn&& f) { _Base::ForeachSlot([&](off o, const Tu& v) { f(v, ToSlot(o)); }); }
+
+		/*
+			Splittable range over the whole set: split() divides it at the subtree root into two ranges of about
+			the same size, which follow each other in order, for_each(f) visits the values of the range in order
+		*/
+		using range = typename _Base::_Split;
+
+		range whole() { return _Base::Whole(); }
+
+		/*
+			Calls f(value) for all values on 'threads' threads (0 - one per core). The set is split into a few ranges
+			per thread, values of every range are visited in order, ranges are taken by threads as they go.
+			f is called from several threads at once, the set must not change meanwhile.
+		*/
+		template <typename Fn>
+		void parallel_for_each(Fn&& f, uint32_t threads = 0)
+		{
+			_Base::ForeachParallel([&](size_t, const Tu& v) { f(v); }, _Threads(threads));
+		}
+
+		/*
+			Parallel reduction: every range (see parallel_for_each) starts from the copy of identity and collects its
+			values in order by acc(Tr& result, const Tu& value), then results of the ranges are folded in order, by
+			Tr combine(Tr left, Tr right), so combine needs to be associative, but not commutative.
+		*/
+		template <typename Tr, typename Fa, typename Fc>
+		Tr parallel_reduce(const Tr& identity, Fa&& acc, Fc&& combine, uint32_t threads = 0)
+		{
+			std::vector<_Partial<Tr>> part(std::max<size_t>(1, (size_t)_Threads(threads) * 4), _Partial<Tr>{ identity });
+
+			_Base::ForeachParallel([&](size_t i, const Tu& v) { acc(part[i].r, v); }, _Threads(threads));
+
+			Tr res = identity;
+			for (auto& p : part)
+			{
+				res = combine(std::move(res), std::move(p.r));
+			}
+
+			return res;
+		}
+
+		/*
+			Set algebra in place: this set becomes the union, intersection or difference of itself and o, which takes
+			O(m log(n/m + 1)) for sizes m <= n, instead of m log n for element-wise insertions or lookups.
+			Elements of this set keep their slots, elements that come from o get new slots.
+
+			With threads > 1 (0 - one per core) the top levels of recursion run in parallel.
+		*/
+		void unite(const set& o, uint32_t threads = 1) { _Base::Combine(o, _Base::_Algebra::Union, _Threads(threads)); }
+		void intersect(const set& o, uint32_t threads = 1) { _Base::Combine(o, _Base::_Algebra::Intersection, _Threads(threads)); }
+		void subtract(const set& o, uint32_t threads = 1) { _Base::Combine(o, _Base::_Algebra::Difference, _Threads(threads)); }
+
+		/*
+			Returns immutable copy of the set, laid out for the fastest lookup, with the same slots (see ifrozen.h)
+		*/
+		frozen_set<Tu, Tc, Tt> freeze()
+		{
+			std::vector<Tu> vals;
+			std::vector<slot> slots;
+
+			vals.reserve(size());
+			slots.reserve(size());
+
+			for (auto it = begin(); it; ++it)
+			{
+				vals.push_back(*it);
+				slots.push_back(ToSlot(_Base::Optr(it.node())));
+			}
+
+			return frozen_set<Tu, Tc, Tt>(vals.data(), slots.data(), vals.size(), _Base::_Cmp);
+		}
 
 
 #ifdef CHECKED_BUILD
@@ -379,8 +2346,60 @@ namespace indexed
 			return _Base::__ValidateIntegrity();
 		}
 #endif
+
+	protected:
+
+		/* result of one range in parallel_reduce, on its own cache line */
+		template <typename Tr>
+		struct alignas(64) _Partial
+		{
+			Tr	r;
+		};
+
+		static inline uint32_t _Threads(uint32_t threads) { return threads ? threads : std::max(1u, std::thread::hardware_concurrency()); }
+
+		template <typename Tk>
+		slot _FindSlot(const Tk& v)
+		{
+			slot o = 0;
+			if (auto it = _Base::FindNode(v))
+			{
+				o = ToSlot(_Base::Optr(it.node()));
+			}
+			return o;
+		}
 	};
 
+
+
+	/*
+		Set algebra, which leaves both arguments as they are: the result is a copy of a combined with b (see set::unite),
+		values of a keep their slots
+	*/
+	template <typename Tu, typename Tc, typename Tt>
+	set<Tu, Tc, Tt> set_union(const set<Tu, Tc, Tt>& a, const set<Tu, Tc, Tt>& b, uint32_t threads = 1)
+	{
+		set<Tu, Tc, Tt> out(a);
+		out.unite(b, threads);
+		return out;
+	}
+
+	template <typename Tu, typename Tc, typename Tt>
+	set<Tu, Tc, Tt> set_intersection(const set<Tu, Tc, Tt>& a, const set<Tu, Tc, Tt>& b, uint32_t threads = 1)
+	{
+		set<Tu, Tc, Tt> out(a);
+		out.intersect(b, threads);
+		return out;
+	}
+
+	template <typename Tu, typename Tc, typename Tt>
+	set<Tu, Tc, Tt> set_difference(const set<Tu, Tc, Tt>& a, const set<Tu, Tc, Tt>& b, uint32_t threads = 1)
+	{
+		set<Tu, Tc, Tt> out(a);
+		out.subtract(b, threads);
+		return out;
+	}
+
 }
 #endif
 
@@ -0,0 +1,745 @@
+#ifndef __base2_core_icompact__
+#define __base2_core_icompact__
+
+#include "./iavl.h"
+
+namespace indexed
+{
+
+#pragma region Compact node ...
+	/*
+		Node for binary tree without parent reference.
+
+		Keeps references of two immediate children only, each reference is a signed byte distance from 'this'
+		to the child, zero when there is no child.
+
+		Nodes are at least 4 bytes apart, so two lowest bits of the left reference are always zero, they carry
+		the balance (Dir) of the node instead, zero balance marks non-initialized or deleted node.
+
+		For 8-byte payload the node takes 16 bytes, inode takes 24.
+	*/
+	template <typename Tu, typename Tt = default_traits>
+	struct cnode
+	{
+		using u8 = typename uint8_t;
+		using off = typename Tt::offset;
+
+		static_assert(std::is_signed<off>::value && std::is_integral<off>::value, "ERR: Offset must be signed integer");
+
+		static constexpr off TILT = 3;
+
+		Tu payload;
+
+		off lt, rt;
+
+
+		inline bool		IsEmpty() const { return 0 == (lt & TILT); }
+
+		inline Dir		Tilt() const { return (Dir)(lt & TILT); }
+		inline void		SetTilt(Dir d) { lt = (off)((lt & ~TILT) | (off)d); }
+
+		/* relative references, zero when child is missing */
+		inline off		Rel(Dir d) const { return d == Dir::Left ? (off)(lt & ~TILT) : rt; }
+
+		inline void		SetRel(Dir d, off r)
+		{
+			if (d == Dir::Left)
+				lt = (off)(r | (lt & TILT));
+			else
+				rt = r;
+		}
+	};
+#pragma endregion
+
+
+
+#pragma region Compact tree ...
+	/*
+		AVL tree of cnode's, same buffer and slot addressing as _AvlTree.
+
+		With no way up from a node, every operation keeps the path from the root: insertion and erasure retrace
+		the balance along the path they descended, iterator carries the stack of nodes above the current one.
+
+		All references inside this object are byte offsets from the head of the buffer, they survive reallocation
+	*/
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = default_traits>
+	struct _CompactTree : protected _TreeBuffer<Tt>
+	{
+		using _Node = typename cnode<Tu, Tt>;
+
+		using _Base = _TreeBuffer<Tt>;
+		using u8 = typename _Base::u8;
+		using u32 = typename _Base::u32;
+		using ulen = typename _Base::ulen;
+		using off = typename _Node::off;
+
+		static_assert(!Tt::counted, "ERR: Compact nodes do not keep subtree sizes");
+		static_assert(sizeof(_Node) % 4 == 0, "ERR: Compact node size must be a multiple of 4, use wider offset");
+
+		static constexpr size_t Nsize() { return sizeof(_Node); }
+
+		/* AVL tree of 2^k nodes is not higher than 1.44 * k, which is well within 1.5 bits per bit of offset */
+		static constexpr u32 MAX_HEIGHT = (u32)(sizeof(off) * 12);
+
+		/* nodes from the root down, with the direction taken at each one */
+		struct _Path
+		{
+			off		n[MAX_HEIGHT];
+			Dir		d[MAX_HEIGHT];
+			u32		len = { 0 };
+
+			inline void push(off o, Dir dir) { n[len] = o; d[len] = dir; ++len; }
+		};
+
+
+		/* in-order iterator, keeps the stack of nodes from the root to the current one, which is on top */
+		struct iterator
+		{
+			iterator() {}
+
+			inline operator bool() const { return depth_ ? true : false; }
+
+			inline bool operator!=(const iterator& o) const { return node() != o.node(); }
+			inline bool operator==(const iterator& o) const { return node() == o.node(); }
+
+			iterator& operator++()
+			{
+				if (!depth_)
+					return *this;
+
+				if (off r = _Child(stack_[depth_ - 1], Dir::Right))
+				{
+					_PushLeftmost(r);
+				}
+				else
+				{
+					//climb while coming from the right
+					off c = stack_[--depth_];
+					while (depth_ && _Child(stack_[depth_ - 1], Dir::Right) == c)
+					{
+						c = stack_[--depth_];
+					}
+				}
+
+				return *this;
+			}
+
+			const Tu& operator*() const { return ((const _Node*)(head_ + stack_[depth_ - 1]))->payload; }
+			const Tu* operator->() const { return &**this; }
+
+			/* offset of the current node, zero for the 'end' */
+			inline off node() const { return depth_ ? stack_[depth_ - 1] : 0; }
+
+
+			const u8*	head_ = { nullptr };
+			off			stack_[MAX_HEIGHT];
+			u32			depth_ = { 0 };
+
+			inline off _Child(off o, Dir d) const
+			{
+				off r = ((const _Node*)(head_ + o))->Rel(d);
+				return r ? o + r : 0;
+			}
+
+			inline void _PushLeftmost(off o)
+			{
+				for (; o; o = _Child(o, Dir::Left))
+				{
+					stack_[depth_++] = o;
+				}
+			}
+		};
+
+
+		//Construction
+		_CompactTree(const Tc& cmp = Tc()) : _Cmp(cmp) {}
+		_CompactTree(const _CompactTree&) = default;
+		_CompactTree(_CompactTree&&) = default;
+		_CompactTree& operator=(const _CompactTree&) = delete;
+		_CompactTree& operator=(_CompactTree&&) = delete;
+		~_CompactTree() { Clear(); }
+
+
+		//helpers
+		inline _Node* N0() { return (_Node*)_Base::_Head(); }
+		inline _Node* Nptr(off o) { return (_Node*)(_Base::_Head() + o); }
+		inline Tu* Tptr(off o) { return &(Nptr(o)->payload); }
+		inline off		Optr(_Node* p) { return (off)((u8*)p - _Base::_Head()); }
+
+		inline off _Child(off o, Dir d)
+		{
+			off r = Nptr(o)->Rel(d);
+			return r ? o + r : 0;
+		}
+
+		inline void _Link(off o, Dir d, off child) { Nptr(o)->SetRel(d, child ? (off)(child - o) : 0); }
+
+
+		inline size_t Size() const { return _Cnt; }
+
+		void Reserve(size_t ElementCount)
+		{
+			if (ElementCount >= (size_t)std::numeric_limits<off>::max() / Nsize())
+				throw std::length_error("Offset type cannot address more nodes");
+
+			_Base::_Reserve((ulen)((ElementCount + 1) * Nsize()));
+		}
+
+
+		template <typename Tk, typename... Ta>
+		std::pair<off, bool> TryEmplace(const Tk& key, Ta&&... args)
+		{
+			if (!_Base::len_)
+			{
+				_Base::_PtrAppendZeroBytes((ulen)(Nsize()));
+			}
+
+			_Path p;
+			if (off f = _Find(key, &p))
+				return { f, false };
+
+			off o = Optr(_CreateNode(std::forward<Ta>(args)...));
+
+			_Replace(p, p.len, o);
+			++_Cnt;
+
+			_RetraceInsert(p);
+
+			return { o, true };
+		}
+
+		template <typename Tk>
+		bool Erase(const Tk& v)
+		{
+			_Path p;
+			if (off t = _Find(v, &p))
+			{
+				_Remove(t, p);
+				return true;
+			}
+			return false;
+		}
+
+		void EraseAtOffset(off o)
+		{
+			if (o > 0 && (ulen)o < _Base::len_ && !Nptr(o)->IsEmpty())
+			{
+				Erase(Nptr(o)->payload);
+			}
+		}
+
+		template <typename Tk>
+		off FindOffset(const Tk& v) { return _Find(v, nullptr); }
+
+		iterator Begin()
+		{
+			iterator it = _Iter();
+			it._PushLeftmost(_Root);
+			return it;
+		}
+
+		iterator End() { return _Iter(); }
+
+		/* iterator of the node with given value, or 'end' */
+		template <typename Tk>
+		iterator FindIter(const Tk& v)
+		{
+			iterator it = _Iter();
+
+			for (off n = _Root; n; )
+			{
+				it.stack_[it.depth_++] = n;
+
+				int c = _Compare3(_Cmp, v, Nptr(n)->payload);
+
+				if (!c)
+					return it;
+
+				n = _Child(n, c < 0 ? Dir::Left : Dir::Right);
+			}
+
+			return _Iter();
+		}
+
+		/* first node that is not less (Upper: greater) than v, the stack is cut at the last node where the descent went left */
+		template <bool Upper, typename Tk>
+		iterator BoundIter(const Tk& v)
+		{
+			iterator it = _Iter();
+			u32 at = 0;
+
+			for (off n = _Root; n; )
+			{
+				it.stack_[it.depth_++] = n;
+
+				bool left = Upper ? _Cmp(v, Nptr(n)->payload) : !_Cmp(Nptr(n)->payload, v);
+
+				if (left)
+					at = it.depth_;
+
+				n = _Child(n, left ? Dir::Left : Dir::Right);
+			}
+
+			it.depth_ = at;
+			return it;
+		}
+
+		off FirstOffset() { off n = _Root; for (off c; n && (c = _Child(n, Dir::Left)); n = c); return n; }
+		off LastOffset() { off n = _Root; for (off c; n && (c = _Child(n, Dir::Right)); n = c); return n; }
+
+		void Clear()
+		{
+			if constexpr (!std::is_trivially_destructible<Tu>::value)
+			{
+				for (size_t o = Nsize(); o < _Base::len_; o += Nsize())
+				{
+					if (!Nptr((off)o)->IsEmpty())
+					{
+						Tptr((off)o)->~Tu();
+					}
+				}
+			}
+
+			_Root = 0;
+			_Cnt = 0;
+
+			_Base::_Reset();
+		}
+
+		template <typename Fn>
+		void Foreach(Fn&& cb)
+		{
+			for (auto it = Begin(); it; ++it)
+			{
+				cb(*it);
+			}
+		}
+
+#ifdef CHECKED_BUILD
+		void __LifeCheck(std::ostream& o)
+		{
+			o << "allocated memory: " << _Base::_Capacity() << std::endl;
+			o << "   reallocations: " << _Base::Reallocs_ << std::endl;
+
+			o << "     used memory: " << _Base::_Size() << std::endl;
+			o << "total node count: " << _Cnt << std::endl;
+			o << "       node size: " << Nsize() << std::endl;
+		}
+
+		/*
+			Verifies balance and order of the entire tree
+		*/
+		bool __ValidateIntegrity()
+		{
+			u32 total = 0;
+
+			if (_Root && _CheckSubtree(_Root, total) < 0)
+				return false;
+
+			const Tu* prev = nullptr;
+			for (auto it = Begin(); it; ++it)
+			{
+				if (prev && !_Cmp(*prev, *it))
+					return false;
+
+				prev = &*it;
+			}
+
+			return total == _Cnt;
+		}
+
+		/* returns height of the subtree or -1 if any violation is found, total is incremented by subtree size */
+		int32_t _CheckSubtree(off n, u32& total)
+		{
+			int32_t hl = 0, hr = 0;
+
+			if (Nptr(n)->IsEmpty())
+				return -1;
+
+			if (off L = _Child(n, Dir::Left))
+			{
+				if ((hl = _CheckSubtree(L, total)) < 0)
+					return -1;
+			}
+
+			if (off R = _Child(n, Dir::Right))
+			{
+				if ((hr = _CheckSubtree(R, total)) < 0)
+					return -1;
+			}
+
+			Dir expected = hl == hr ? Dir::None : (hl > hr ? Dir::Left : Dir::Right);
+
+			if (hl - hr > 1 || hr - hl > 1 || Nptr(n)->Tilt() != expected)
+				return -1;
+
+			++total;
+			return 1 + std::max(hl, hr);
+		}
+#endif
+
+	protected:
+
+		inline iterator _Iter() const
+		{
+			iterator it;
+			it.head_ = _Base::_Head();
+			return it;
+		}
+
+		/*
+			Descends to the node with given value and returns its offset, or zero if not found.
+			Path (if given) receives all nodes above the found one, or above the place where the value belongs.
+		*/
+		template <typename Tk>
+		off _Find(const Tk& v, _Path* p)
+		{
+			for (off n = _Root; n; )
+			{
+				int c = _Compare3(_Cmp, v, Nptr(n)->payload);
+
+				if (!c)
+					return n;
+
+				Dir d = c < 0 ? Dir::Left : Dir::Right;
+
+				if (p)
+				{
+					p->push(n, d);
+				}
+
+				n = _Child(n, d);
+			}
+
+			return 0;
+		}
+
+		/* links subtree r in place of the node at path position i, the root if i is zero */
+		inline void _Replace(const _Path& p, u32 i, off r)
+		{
+			if (i)
+				_Link(p.n[i - 1], p.d[i - 1], r);
+			else
+				_Root = r;
+		}
+
+		/*
+			Rotates the subtree of n, which is too heavy on side h, and returns its new root.
+
+			The new root is balanced, unless the child on heavy side was balanced (possible after erasure only),
+			in which case the height of the subtree does not change.
+		*/
+		off _Rotate(off n, Dir h)
+		{
+			Dir o = ~h;
+			off c = _Child(n, h);
+			Dir ct = Nptr(c)->Tilt();
+
+			if (ct != o)
+			{
+				//single rotation
+				_Link(n, h, _Child(c, o));
+				_Link(c, o, n);
+
+				if (ct == h)
+				{
+					Nptr(n)->SetTilt(Dir::None);
+					Nptr(c)->SetTilt(Dir::None);
+				}
+				else
+				{
+					Nptr(n)->SetTilt(h);
+					Nptr(c)->SetTilt(o);
+				}
+
+				return c;
+			}
+
+			//double rotation, grandchild g becomes the root
+			off g = _Child(c, o);
+			Dir gt = Nptr(g)->Tilt();
+
+			_Link(c, o, _Child(g, h));
+			_Link(n, h, _Child(g, o));
+			_Link(g, h, c);
+			_Link(g, o, n);
+
+			Nptr(n)->SetTilt(gt == h ? o : Dir::None);
+			Nptr(c)->SetTilt(gt == o ? h : Dir::None);
+			Nptr(g)->SetTilt(Dir::None);
+
+			return g;
+		}
+
+		/* new node was linked at the end of the path, branches on the path became longer */
+		void _RetraceInsert(const _Path& p)
+		{
+			for (u32 i = p.len; i-- > 0; )
+			{
+				_Node* N = Nptr(p.n[i]);
+
+				if (N->Tilt() == Dir::None)
+				{
+					N->SetTilt(p.d[i]);
+				}
+				else if (N->Tilt() != p.d[i])
+				{
+					//counter-balanced, the height above does not change
+					N->SetTilt(Dir::None);
+					break;
+				}
+				else
+				{
+					//rotated subtree keeps the height it had before insertion
+					_Replace(p, i, _Rotate(p.n[i], p.d[i]));
+					break;
+				}
+			}
+		}
+
+		/* a node was unlinked at the end of the path, branches on the path became shorter */
+		void _RetraceErase(const _Path& p)
+		{
+			for (u32 i = p.len; i-- > 0; )
+			{
+				_Node* N = Nptr(p.n[i]);
+
+				if (N->Tilt() == Dir::None)
+				{
+					//the height of this subtree does not change
+					N->SetTilt(~p.d[i]);
+					break;
+				}
+				else if (N->Tilt() == p.d[i])
+				{
+					N->SetTilt(Dir::None);
+				}
+				else
+				{
+					off r = _Rotate(p.n[i], ~p.d[i]);
+					_Replace(p, i, r);
+
+					if (Nptr(r)->Tilt() != Dir::None)
+						break;
+				}
+			}
+		}
+
+		/* removes node t, path leads to it */
+		void _Remove(off t, _Path& p)
+		{
+			_Base::_CheckWritable();
+
+			_Node* T = Nptr(t);
+			off l = _Child(t, Dir::Left), r = _Child(t, Dir::Right);
+
+			if (l && r)
+			{
+				//closest node on the heavier side takes the place of t, other nodes keep their slots
+				Dir h = T->Tilt() == Dir::Right ? Dir::Right : Dir::Left;
+				u32 ti = p.len;
+
+				p.push(t, h);
+
+				off s = _Child(t, h);
+				for (off x; 0 != (x = _Child(s, ~h)); s = x)
+				{
+					p.push(s, ~h);
+				}
+
+				_Link(p.n[p.len - 1], p.d[p.len - 1], _Child(s, h));
+
+				_Link(s, Dir::Left, _Child(t, Dir::Left));
+				_Link(s, Dir::Right, _Child(t, Dir::Right));
+				Nptr(s)->SetTilt(T->Tilt());
+
+				_Replace(p, ti, s);
+				p.n[ti] = s;
+			}
+			else
+			{
+				_Replace(p, p.len, l ? l : r);
+			}
+
+			--_Cnt;
+
+			_RetraceErase(p);
+
+			//t is wiped out and connected to the chain of deleted nodes
+			T = Nptr(t);
+			T->payload.~Tu();
+			memset(T, 0, Nsize());
+
+			if (off d = N0()->rt)
+			{
+				T->rt = (off)(d - t);
+			}
+			N0()->rt = t;
+		}
+
+		/* adds blank node at the end of the buffer, throws when its offset would not fit the offset type */
+		inline _Node* _AppendNode()
+		{
+			if ((uint64_t)_Base::len_ + Nsize() > (uint64_t)std::numeric_limits<off>::max())
+				throw std::length_error("Offset type cannot address more nodes");
+
+			return (_Node*)_Base::_PtrAppendZeroBytes((ulen)Nsize());
+		}
+
+		//returns 'deleted' node if present, or appends a new one, payload is constructed from args
+		template <typename... Ta>
+		inline _Node* _CreateNode(Ta&&... args)
+		{
+			_Base::_CheckWritable();
+
+			_Node* n = nullptr;
+
+			if (off d = N0()->rt)
+			{
+				//dequeue
+				n = Nptr(d);
+				N0()->rt = n->rt ? (off)(d + n->rt) : 0;
+				n->rt = 0;
+			}
+			else
+			{
+				n = _AppendNode();
+			}
+
+			n->SetTilt(Dir::None);
+
+			//aggregates are brace-initialized, since they have no constructors before C++20
+			if constexpr (std::is_constructible<Tu, Ta&&...>::value)
+			{
+				new (&n->payload) Tu(std::forward<Ta>(args)...);
+			}
+			else
+			{
+				new (&n->payload) Tu{ std::forward<Ta>(args)... };
+			}
+
+			return n;
+		}
+
+
+		u32		_Cnt = { 0 };
+		off		_Root = { 0 };
+
+		//comparator instance, which is used by all searches, so it can carry a state
+		Tc		_Cmp;
+	};
+#pragma endregion
+
+
+
+	/*
+		Set with the same slot addressing as indexed::set, built of compact nodes without parent references,
+		which take 8 bytes less per element (for 32-bit offsets) and pack more nodes into every cache line.
+
+		Iterators are heavier, since they carry the path from the root, and remain valid only while the set
+		is not modified. Order statistics, hinted insertion, persistence and relayout are not available.
+	*/
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = default_traits>
+	struct compact_set : protected _CompactTree<Tu, Tc, Tt>
+	{
+		static_assert(std::is_trivially_copyable<Tu>::value);
+
+		using _Base = typename _CompactTree<Tu, Tc, Tt>;
+		using iter = typename _Base::iterator;
+
+		using off = typename _Base::off;
+
+		static constexpr slot ToSlot(off o) { return o ? (slot)(size_t(o) / _Base::Nsize()) : 0; }
+
+
+		compact_set(size_t initialCount = 0, const Tc& cmp = Tc()) : _Base(cmp) { if (initialCount) _Base::Reserve(initialCount); }
+
+		compact_set(const compact_set&) = default;
+		compact_set(compact_set&&) = default;
+		compact_set& operator=(const compact_set&) = delete;
+		compact_set& operator=(compact_set&&) = delete;
+
+
+		inline size_t	size() const { return _Base::Size(); }
+		inline bool		empty() const { return 0 == size() ? true : false; }
+
+		inline void		reserve(size_t count) { _Base::Reserve(count); }
+
+		/* returns slot number for specified value and boolean flag, indicating that a given value was actually inserted */
+		std::pair<slot, bool> insert(const Tu& v)
+		{
+			auto [o, added] = _Base::TryEmplace(v, v);
+			return  { ToSlot(o), added };
+		}
+
+		template <typename Tk, typename... Ta>
+		std::pair<slot, bool> try_emplace(const Tk& key, Ta&&... args)
+		{
+			auto [o, added] = _Base::TryEmplace(key, std::forward<Ta>(args)...);
+			return  { ToSlot(o), added };
+		}
+
+		void erase(const Tu& v) { _Base::Erase(v); }
+		void erase_at(slot pos) { _Base::EraseAtOffset((off)(pos * _Base::Nsize())); }
+
+		iter find(const Tu& v) { return _Base::FindIter(v); }
+		slot find_slot(const Tu& v) { return ToSlot(_Base::FindOffset(v)); }
+
+		inline const Tu& at(slot pos)
+		{
+			return *_Base::Tptr((off)(pos * _Base::Nsize()));
+		}
+
+		iter begin() { return _Base::Begin(); }
+		iter end() { return _Base::End(); }
+
+		/* smallest and largest elements, the set must not be empty */
+		inline const Tu& front() { return *_Base::Tptr(_Base::FirstOffset()); }
+		inline const Tu& back() { return *_Base::Tptr(_Base::LastOffset()); }
+
+		/* first element that is not less than v */
+		iter lower_bound(const Tu& v) { return _Base::template BoundIter<false>(v); }
+
+		/* first element that is greater than v */
+		iter upper_bound(const Tu& v) { return _Base::template BoundIter<true>(v); }
+
+		std::pair<iter, iter> equal_range(const Tu& v) { return { lower_bound(v), upper_bound(v) }; }
+
+
+		/* heterogeneous lookup, same as in indexed::set */
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		iter find(const Tk& k) { return _Base::FindIter(k); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		slot find_slot(const Tk& k) { return ToSlot(_Base::FindOffset(k)); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		void erase(const Tk& k) { _Base::Erase(k); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		iter lower_bound(const Tk& k) { return _Base::template BoundIter<false>(k); }
+
+		template <typename Tk, typename Tx = Tc, typename = typename Tx::is_transparent>
+		iter upper_bound(const Tk& k) { return _Base::template BoundIter<true>(k); }
+
+
+		void clear() { _Base::Clear(); }
+
+		template <typename Fn>
+		void foreach(Fn&& f) { _Base::Foreach(f); }
+
+
+#ifdef CHECKED_BUILD
+		void dbg_report(std::ostream& o = std::cout)
+		{
+			_Base::__LifeCheck(o);
+		}
+		bool dbg_validate()
+		{
+			return _Base::__ValidateIntegrity();
+		}
+#endif
+	};
+
+}
+#endif
@@ -0,0 +1,571 @@
+#ifndef __base2_core_iconcurrent__
+#define __base2_core_iconcurrent__
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "./iavl.h"
+
+namespace indexed
+{
+
+#pragma region Reader slots ...
+	/*
+		Every reader owns one slot, where it announces what it reads, or zero when idle: the epoch it pinned
+		(concurrent_set) or one of two copies, plus one (mirrored_set).
+
+		Reader announces first and looks at what the writer published after that. All of it is sequentially
+		consistent, so once the writer published and then scanned the slots, every reader either is seen in
+		its slot or comes after the publication and reads the new state.
+	*/
+	struct _ReaderSlots
+	{
+		static constexpr uint32_t MAX_READERS = 64;
+
+		struct alignas(64) _Slot
+		{
+			std::atomic<uint64_t>	reading = { 0 };
+			std::atomic<bool>		taken = { false };
+		};
+
+		_ReaderSlots() {}
+		_ReaderSlots(const _ReaderSlots&) = delete;
+		_ReaderSlots& operator=(const _ReaderSlots&) = delete;
+
+		/* takes a free reader slot, throws if all are taken */
+		uint32_t Claim()
+		{
+			for (uint32_t i = 0; i < MAX_READERS; ++i)
+			{
+				bool expected = false;
+				if (!slots_[i].taken.load(std::memory_order_relaxed) &&
+					slots_[i].taken.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+				{
+					return i;
+				}
+			}
+
+			throw std::runtime_error("Too many concurrent readers");
+		}
+
+		void Release(uint32_t i) { slots_[i].taken.store(false, std::memory_order_release); }
+
+		/* reader: returns the front copy, which is not changed until Leave */
+		uint32_t Enter(uint32_t i, const std::atomic<uint32_t>& front)
+		{
+			for (;;)
+			{
+				uint32_t f = front.load(std::memory_order_seq_cst);
+				slots_[i].reading.store(f + 1, std::memory_order_seq_cst);
+
+				if (front.load(std::memory_order_seq_cst) == f)
+					return f;
+			}
+		}
+
+		/* reader: announces the epoch, the state published before it is not released until Leave */
+		inline void Pin(uint32_t i, uint64_t epoch) { slots_[i].reading.store(epoch, std::memory_order_seq_cst); }
+
+		inline void Leave(uint32_t i) { slots_[i].reading.store(0, std::memory_order_release); }
+
+		/* writer: the oldest epoch that is pinned now, or UINT64_MAX if there are no readers */
+		uint64_t Oldest() const
+		{
+			uint64_t r = UINT64_MAX;
+
+			for (auto& s : slots_)
+			{
+				uint64_t e = s.reading.load(std::memory_order_seq_cst);
+				if (e && e < r)
+				{
+					r = e;
+				}
+			}
+
+			return r;
+		}
+
+		/* writer, after the front moved away from copy f: waits for readers, which still read it */
+		void Drain(uint32_t f) const
+		{
+			for (auto& s : slots_)
+			{
+				while (s.reading.load(std::memory_order_seq_cst) == f + 1)
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+	protected:
+
+		_Slot	slots_[MAX_READERS];
+	};
+#pragma endregion
+
+
+
+#ifdef INDEXED_COW
+	/* traits of concurrent_set: published states share memory pages with the set */
+	struct concurrent_traits : default_traits
+	{
+		using backend = cow_backend;
+	};
+#else
+	using concurrent_traits = default_traits;
+#endif
+
+	/*
+		Set with one writer thread and many reader threads, readers take no locks and never wait for the writer.
+
+		The writer changes its own tree, which readers never touch, and makes the changes visible with publish():
+		it takes a read-only snapshot of the tree (see set::snapshot) and swaps it in as the current state with
+		release semantics. Readers pin the current epoch in their slot (see _ReaderSlots) and read the current
+		state, so every lookup sees the state of some publish() in full. The state that was current before is
+		retired with the epoch of its publication, and released only when no reader has an epoch that old pinned.
+		The writer never waits, a reader that is preempted in the middle of a lookup only delays that release.
+
+		With concurrent_traits (cow_backend where available) a published state shares memory pages with the set,
+		so publish() costs a scan of the page table and a copy of the pages changed since the previous publish().
+		With other backends every publish() copies the whole node buffer, so writes should be published in batches.
+	*/
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = concurrent_traits>
+	struct concurrent_set
+	{
+		static_assert(std::is_trivially_copyable<Tu>::value);
+
+		using _Tree = _AvlTree<Tu, Tc, Tt>;
+		using off = typename _Tree::off;
+
+		static constexpr slot ToSlot(off o) { return o ? (slot)(size_t(o) / _Tree::Nsize()) : 0; }
+
+
+		concurrent_set(size_t initialCount = 0, const Tc& cmp = Tc()) : _Live(cmp), _Cmp(cmp)
+		{
+			if (initialCount)
+				_Live.Reserve(initialCount);
+
+			_Current.store(new _State(_Cmp), std::memory_order_release);
+		}
+
+		~concurrent_set()
+		{
+			delete _Current.load(std::memory_order_relaxed);
+
+			for (auto r : _Retired)
+			{
+				delete r;
+			}
+		}
+
+		concurrent_set(const concurrent_set&) = delete;
+		concurrent_set(concurrent_set&&) = delete;
+		concurrent_set& operator=(const concurrent_set&) = delete;
+		concurrent_set& operator=(concurrent_set&&) = delete;
+
+
+		/*
+			Reader handle, owned by one thread, takes one of reader slots for its life time.
+			All calls see the state of the last publish() before them, or a later one.
+		*/
+		struct reader
+		{
+			reader(concurrent_set& s) : s_(s), id_(s._Readers.Claim()) {}
+			~reader() { s_._Readers.Release(id_); }
+
+			reader(const reader&) = delete;
+			reader& operator=(const reader&) = delete;
+
+			/* slot of the value, or zero */
+			template <typename Tk>
+			slot find_slot(const Tk& k)
+			{
+				return s_._Read(id_, [&](_Tree& t)
+					{
+						auto it = t.FindNode(k);
+						return it ? ToSlot(t.Optr(it.node())) : 0;
+					});
+			}
+
+			template <typename Tk>
+			bool contains(const Tk& k) { return find_slot(k) ? true : false; }
+
+			/* copies the value in the slot, returns false if the slot is not in use */
+			bool at(slot pos, Tu& out)
+			{
+				return s_._Read(id_, [&](_Tree& t)
+					{
+						auto n = t.NUsedPtr(pos);
+						if (n)
+						{
+							out = n->payload;
+						}
+						return n ? true : false;
+					});
+			}
+
+			size_t size() { return s_._Read(id_, [&](_Tree& t) { return t.Size(); }); }
+
+		protected:
+			concurrent_set&	s_;
+			uint32_t		id_;
+		};
+
+
+		//Writer, only one thread at a time, changes are seen by readers after publish()
+
+		std::pair<slot, bool> insert(const Tu& v)
+		{
+			auto [o, added] = _Live.Insert(v);
+			return { ToSlot(o), added };
+		}
+
+		void erase(const Tu& v) { _Live.Erase(v); }
+		void erase_at(slot pos) { _Live.EraseAtOffset((off)(pos * _Tree::Nsize())); }
+
+		void reserve(size_t count) { _Live.Reserve(count); }
+		void clear() { _Live.Clear(); }
+
+		/* makes all changes so far visible to readers, the state they saw until now is retired */
+		void publish()
+		{
+			std::unique_ptr<_State> s(new _State(_Cmp));
+			_Live.SnapshotTo(s->tree);
+
+			_Retired.reserve(_Retired.size() + 1);
+
+			_State* old = _Current.exchange(s.release(), std::memory_order_seq_cst);
+
+			//readers, which could take the old state, pinned this epoch or an earlier one
+			old->epoch = _Epoch.fetch_add(1, std::memory_order_seq_cst);
+			_Retired.push_back(old);
+
+			_Reclaim();
+		}
+
+		/* writer's own lookups see all changes, published or not */
+		slot find_slot(const Tu& v)
+		{
+			auto it = _Live.FindNode(v);
+			return it ? ToSlot(_Live.Optr(it.node())) : 0;
+		}
+
+		inline const Tu& at(slot pos) { return *_Live.Tptr((off)(pos * _Tree::Nsize())); }
+
+		inline size_t size() { return _Live.Size(); }
+
+		/* number of retired states, which readers may still read */
+		inline size_t retired() const { return _Retired.size(); }
+
+
+#ifdef CHECKED_BUILD
+		/* integrity of the set and of the current state, writer only */
+		bool dbg_validate() { return _Live.__ValidateIntegrity() && _Current.load(std::memory_order_relaxed)->tree.__ValidateIntegrity(); }
+#endif
+
+	protected:
+
+		/* published state and the epoch when it was retired */
+		struct _State
+		{
+			_State(const Tc& cmp) : tree(cmp) {}
+
+			_Tree		tree;
+			uint64_t	epoch = { 0 };
+		};
+
+		/* releases retired states, which no reader can see */
+		void _Reclaim()
+		{
+			uint64_t oldest = _Readers.Oldest();
+
+			size_t kept = 0;
+			for (auto r : _Retired)
+			{
+				if (r->epoch < oldest)
+				{
+					delete r;
+				}
+				else
+				{
+					_Retired[kept++] = r;
+				}
+			}
+
+			_Retired.resize(kept);
+		}
+
+		/* runs reading function fr(tree) on the current state */
+		template <typename Fr>
+		auto _Read(uint32_t id, Fr&& fr)
+		{
+			_Readers.Pin(id, _Epoch.load(std::memory_order_seq_cst));
+
+			_Tree& t = _Current.load(std::memory_order_seq_cst)->tree;
+
+			try
+			{
+				auto r = fr(t);
+				_Readers.Leave(id);
+				return r;
+			}
+			catch (...)
+			{
+				_Readers.Leave(id);
+				throw;
+			}
+		}
+
+
+		_Tree					_Live;
+		Tc						_Cmp;
+
+		//state that readers take
+		std::atomic<_State*>	_Current = { nullptr };
+
+		//epoch of the next retirement, starts at 1, zero in a reader slot means idle
+		std::atomic<uint64_t>	_Epoch = { 1 };
+
+		//states that were current before, oldest first
+		std::vector<_State*>	_Retired;
+
+		_ReaderSlots			_Readers;
+	};
+
+
+
+	/*
+		Alternative to concurrent_set, where readers see every write as soon as it returns, with no publish().
+
+		The tree is kept in two copies (left-right technique). Readers read the front copy, while the writer
+		changes the back one, so they never touch the same memory. When done, the writer makes the back copy
+		the front. The same change is applied to the old front on the next write, after readers that still read
+		it have left, which by then they usually have. Both copies start equal and get the same changes in the
+		same order, so they have the same slots.
+
+		Reader (see mirrored_set::reader, one per thread) announces the copy it reads in its own slot (see
+		_ReaderSlots), so no reader sees a copy in the middle of a change, and buffers are never released under it.
+		Only the writer may wait, for readers that are in the middle of a lookup. When threads outnumber cores,
+		such reader may be preempted, and the writer waits until it is scheduled again.
+
+		The price: every change is made twice, the memory is doubled, and the writer may wait for readers.
+		Prefer concurrent_set for large sets, or when writes can be published in batches.
+	*/
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = default_traits>
+	struct mirrored_set
+	{
+		static_assert(std::is_trivially_copyable<Tu>::value);
+
+		using _Tree = _AvlTree<Tu, Tc, Tt>;
+		using off = typename _Tree::off;
+
+		static constexpr slot ToSlot(off o) { return o ? (slot)(size_t(o) / _Tree::Nsize()) : 0; }
+
+
+		mirrored_set(size_t initialCount = 0, const Tc& cmp = Tc()) : _Copies{ _Tree(cmp), _Tree(cmp) }
+		{
+			if (initialCount)
+				reserve(initialCount);
+		}
+
+		mirrored_set(const mirrored_set&) = delete;
+		mirrored_set(mirrored_set&&) = delete;
+		mirrored_set& operator=(const mirrored_set&) = delete;
+		mirrored_set& operator=(mirrored_set&&) = delete;
+
+
+		/*
+			Reader handle, owned by one thread, takes one of reader slots for its life time.
+			All calls see the state after some completed write.
+		*/
+		struct reader
+		{
+			reader(mirrored_set& s) : s_(s), id_(s._Readers.Claim()) {}
+			~reader() { s_._Readers.Release(id_); }
+
+			reader(const reader&) = delete;
+			reader& operator=(const reader&) = delete;
+
+			/* slot of the value, or zero */
+			template <typename Tk>
+			slot find_slot(const Tk& k)
+			{
+				return s_._Read(id_, [&](_Tree& t)
+					{
+						auto it = t.FindNode(k);
+						return it ? ToSlot(t.Optr(it.node())) : 0;
+					});
+			}
+
+			template <typename Tk>
+			bool contains(const Tk& k) { return find_slot(k) ? true : false; }
+
+			/* copies the value in the slot, returns false if the slot is not in use */
+			bool at(slot pos, Tu& out)
+			{
+				return s_._Read(id_, [&](_Tree& t)
+					{
+						auto n = t.NUsedPtr(pos);
+						if (n)
+						{
+							out = n->payload;
+						}
+						return n ? true : false;
+					});
+			}
+
+			size_t size() { return s_._Read(id_, [&](_Tree& t) { return t.Size(); }); }
+
+		protected:
+			mirrored_set&	s_;
+			uint32_t		id_;
+		};
+
+
+		//Writer, only one thread at a time
+
+		std::pair<slot, bool> insert(const Tu& v) { return _Write(_Change(_Change::Insert, &v)); }
+
+		void erase(const Tu& v) { _Write(_Change(_Change::Erase, &v)); }
+		void erase_at(slot pos) { _Write(_Change(_Change::EraseAt, nullptr, pos)); }
+
+		void reserve(size_t count) { _Write(_Change(_Change::Reserve, nullptr, count)); }
+		void clear() { _Write(_Change(_Change::Clear)); }
+
+		/* writer's own lookups need no protection, the front copy is up to date and the writer is the only one to change it */
+		slot find_slot(const Tu& v)
+		{
+			auto it = _FrontCopy().FindNode(v);
+			return it ? ToSlot(_FrontCopy().Optr(it.node())) : 0;
+		}
+
+		inline const Tu& at(slot pos) { return *_FrontCopy().Tptr((off)(pos * _Tree::Nsize())); }
+
+		inline size_t size() { return _FrontCopy().Size(); }
+
+
+#ifdef CHECKED_BUILD
+		/* integrity of both copies, which must hold the same values in the same slots, writer only */
+		bool dbg_validate()
+		{
+			_CatchUp();
+
+			_Tree& a = _Copies[0], & b = _Copies[1];
+
+			if (!a.__ValidateIntegrity() || !b.__ValidateIntegrity() || a.Size() != b.Size())
+				return false;
+
+			for (auto i = a.Begin(), j = b.Begin(); i; ++i, ++j)
+			{
+				if (a.Optr(i.node()) != b.Optr(j.node()))
+					return false;
+			}
+
+			return true;
+		}
+#endif
+
+	protected:
+
+		/* change, which is applied to both copies, keeps a copy of the value (Tu needs no default constructor) */
+		struct _Change
+		{
+			enum Kind : uint8_t { None, Insert, Erase, EraseAt, Reserve, Clear };
+
+			_Change(Kind k = None, const Tu* pv = nullptr, size_t count = 0) : kind(k), n(count)
+			{
+				if (pv)
+				{
+					memcpy(v, (const void*)pv, sizeof(Tu));
+				}
+			}
+
+			inline const Tu& Value() const { return *(const Tu*)v; }
+
+			Kind	kind;
+			size_t	n;
+
+			alignas(Tu) uint8_t v[sizeof(Tu)];
+		};
+
+		static std::pair<off, bool> _Apply(_Tree& t, const _Change& c)
+		{
+			switch (c.kind)
+			{
+			case _Change::Insert:	return t.Insert(c.Value());
+			case _Change::Erase:	t.Erase(c.Value()); break;
+			case _Change::EraseAt:	t.EraseAtOffset((off)(c.n * _Tree::Nsize())); break;
+			case _Change::Reserve:	t.Reserve(c.n); break;
+			case _Change::Clear:	t.Clear(); break;
+			default: break;
+			}
+
+			return { 0, true };
+		}
+
+		inline _Tree& _FrontCopy() { return _Copies[_Front.load(std::memory_order_relaxed)]; }
+
+		/*
+			Waits for readers of the back copy and applies the last change to it, so both copies are equal.
+			The change is kept until it is applied, so if that throws, the next write tries it again.
+		*/
+		void _CatchUp()
+		{
+			uint32_t b = _Front.load(std::memory_order_relaxed) ^ 1;
+
+			_Readers.Drain(b);
+
+			_Apply(_Copies[b], _Last);
+			_Last.kind = _Change::None;
+		}
+
+		/* brings the back copy up to date, applies the change to it and makes it the front, the front stays if any of it throws */
+		std::pair<slot, bool> _Write(const _Change& c)
+		{
+			_CatchUp();
+
+			uint32_t b = _Front.load(std::memory_order_relaxed) ^ 1;
+
+			auto r = _Apply(_Copies[b], c);
+
+			_Front.store(b, std::memory_order_seq_cst);
+			_Last = c;
+
+			return { ToSlot(r.first), r.second };
+		}
+
+		/* runs reading function fr(tree) on the front copy */
+		template <typename Fr>
+		auto _Read(uint32_t id, Fr&& fr)
+		{
+			_Tree& t = _Copies[_Readers.Enter(id, _Front)];
+
+			try
+			{
+				auto r = fr(t);
+				_Readers.Leave(id);
+				return r;
+			}
+			catch (...)
+			{
+				_Readers.Leave(id);
+				throw;
+			}
+		}
+
+
+		_Tree					_Copies[2];
+
+		//copy that readers take
+		std::atomic<uint32_t>	_Front = { 0 };
+
+		//change that is applied to the front copy, but not yet to the back one
+		_Change					_Last;
+
+		_ReaderSlots			_Readers;
+	};
+
+}
+#endif
@@ -0,0 +1,353 @@
+#ifndef __base2_core_ifrozen__
+#define __base2_core_ifrozen__
+
+#include "./iavl.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INDEXED_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace indexed
+{
+
+#pragma region Block rank ...
+	/*
+		Number of keys in the block of B keys that are less than v, branchless.
+
+		Blocks of 16 four-byte keys (one cache line) are compared by SSE2, four keys per instruction,
+		other blocks by a plain loop, which compiler is free to vectorize.
+	*/
+	template <uint32_t B, typename Tu, typename Tc>
+	struct _BlockRank
+	{
+		static inline uint32_t Of(const Tu* keys, const Tu& v, const Tc& cmp)
+		{
+			uint32_t i = 0;
+			for (uint32_t j = 0; j < B; ++j)
+			{
+				i += cmp(keys[j], v) ? 1 : 0;
+			}
+			return i;
+		}
+	};
+
+#ifdef INDEXED_SSE2
+	inline uint32_t _HorizontalSum(__m128i acc)
+	{
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+		return (uint32_t)_mm_cvtsi128_si32(acc);
+	}
+
+	//compare masks are -1 for every key that is less, subtracting them counts the keys
+	template <>
+	struct _BlockRank<16, int32_t, std::less<int32_t>>
+	{
+		static inline uint32_t Of(const int32_t* keys, int32_t v, const std::less<int32_t>&)
+		{
+			__m128i vv = _mm_set1_epi32(v), acc = _mm_setzero_si128();
+
+			for (int j = 0; j < 16; j += 4)
+			{
+				acc = _mm_sub_epi32(acc, _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(keys + j)), vv));
+			}
+
+			return _HorizontalSum(acc);
+		}
+	};
+
+	//unsigned keys are compared as signed after flipping the sign bit
+	template <>
+	struct _BlockRank<16, uint32_t, std::less<uint32_t>>
+	{
+		static inline uint32_t Of(const uint32_t* keys, uint32_t v, const std::less<uint32_t>&)
+		{
+			__m128i sign = _mm_set1_epi32((int)0x80000000u);
+			__m128i vv = _mm_xor_si128(_mm_set1_epi32((int)v), sign), acc = _mm_setzero_si128();
+
+			for (int j = 0; j < 16; j += 4)
+			{
+				__m128i k = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + j)), sign);
+				acc = _mm_sub_epi32(acc, _mm_cmplt_epi32(k, vv));
+			}
+
+			return _HorizontalSum(acc);
+		}
+	};
+
+	template <>
+	struct _BlockRank<16, float, std::less<float>>
+	{
+		static inline uint32_t Of(const float* keys, float v, const std::less<float>&)
+		{
+			__m128 vv = _mm_set1_ps(v);
+			__m128i acc = _mm_setzero_si128();
+
+			for (int j = 0; j < 16; j += 4)
+			{
+				acc = _mm_sub_epi32(acc, _mm_castps_si128(_mm_cmplt_ps(_mm_loadu_ps(keys + j), vv)));
+			}
+
+			return _HorizontalSum(acc);
+		}
+	};
+#endif
+#pragma endregion
+
+
+
+	/*
+		Immutable, read-only copy of indexed::set, made by set::freeze(), which finds the same slots as the set.
+
+		Keys are stored in implicit search tree of blocks, B keys each, laid out level by level (Eytzinger layout),
+		block k has its children at k * (B + 1) + 1 ... k * (B + 1) + B + 1. There are no links, the whole
+		descent is branchless and walks down the array, touching one block per level:
+			- arithmetic keys with std::less form blocks of one cache line, compared by SIMD where available
+			- other keys form blocks of one key, which is the classic Eytzinger layout, and descendants of the
+			  current key a few levels below (see PF) are prefetched on the way down
+			- find_slots descends for a group of keys at once and prefetches the next block of every key
+
+		The last block is padded by the value that no key is greater than (infinity for floating point keys, the
+		largest value for integer ones), so the padding comes after all keys and has slot zero.
+
+		thaw() restores mutable indexed::set, with the same slots.
+	*/
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = default_traits>
+	struct frozen_set
+	{
+		using u32 = uint32_t;
+
+		//only plain std::less<Tu>: transparent std::less<> takes keys of other types, which must not be converted to Tu
+		static constexpr bool WIDE = std::is_arithmetic<Tu>::value && std::is_same<Tc, std::less<Tu>>::value;
+
+		//keys per block
+		static constexpr u32 B = WIDE ? (u32)std::max<size_t>(1, 64 / sizeof(Tu)) : 1;
+
+		/*
+			Single-key blocks: descendants of key k that are log2(PF) levels below it are PF keys in a row, starting
+			at PF * k + PF - 1, the first of them is prefetched. That is 4 levels ahead for keys of up to 4 bytes,
+			3 for 8-byte keys and 2 for wider ones, the row takes one cache line for keys of up to 16 bytes.
+		*/
+		static constexpr size_t PF = std::max<size_t>(4, sizeof(Tu) <= 4 ? 16 : (sizeof(Tu) <= 8 ? 8 : 4));
+
+
+		frozen_set(const Tc& cmp = Tc()) : _Cmp(cmp) {}
+
+		/* builds from count sorted unique values, slots[i] is the slot of i-th value */
+		frozen_set(const Tu* sorted, const slot* slots, size_t count, const Tc& cmp = Tc()) : _Cmp(cmp)
+		{
+			_Cnt = count;
+			_Blocks = (count + B - 1) / B;
+
+			_Keys.resize(_Blocks * B);
+			_Slots.resize(_Blocks * B, 0);
+
+			size_t i = 0;
+			_Fill(0, i, sorted, slots);
+		}
+
+		inline size_t	size() const { return _Cnt; }
+		inline bool		empty() const { return 0 == _Cnt ? true : false; }
+
+		/* slot of the value in the set it was frozen from, or zero if not found */
+		template <typename Tk>
+		slot find_slot(const Tk& v) const
+		{
+			size_t i = _LowerBound(v);
+			return (i < _Keys.size() && !_Cmp(v, _Keys[i])) ? _Slots[i] : 0;
+		}
+
+		template <typename Tk>
+		bool contains(const Tk& v) const { return find_slot(v) ? true : false; }
+
+		/*
+			Batched find_slot: out[i] receives the slot of in[i] or zero. Descents of a group of keys go down level
+			by level together, and the block every key goes to next is prefetched while the others are compared,
+			so their cache misses overlap. Pays off for big sets and random keys, with blocks of any size.
+		*/
+		template <typename Tk>
+		void find_slots(const Tk* in, size_t count, slot* out) const
+		{
+			constexpr u32 G = LOOKUP_GROUP;
+
+			const Tu* keys = _Keys.data();
+
+			size_t k[G], res[G];
+
+			for (size_t g = 0; g < count; g += G)
+			{
+				u32 n = (u32)std::min<size_t>(G, count - g);
+
+				for (u32 j = 0; j < n; ++j)
+				{
+					k[j] = 0;
+					res[j] = _Keys.size();
+				}
+
+				for (bool more = _Blocks > 0; more; )
+				{
+					more = false;
+
+					for (u32 j = 0; j < n; ++j)
+					{
+						if (k[j] >= _Blocks)
+							continue;
+
+						u32 i = _Rank(keys, k[j], in[g + j]);
+
+						res[j] = i < B ? k[j] * B + i : res[j];
+						k[j] = k[j] * (B + 1) + i + 1;
+
+						if (k[j] < _Blocks)
+						{
+							_Prefetch(keys + k[j] * B);
+							more = true;
+						}
+					}
+				}
+
+				for (u32 j = 0; j < n; ++j)
+				{
+					out[g + j] = (res[j] < _Keys.size() && !_Cmp(in[g + j], keys[res[j]])) ? _Slots[res[j]] : 0;
+				}
+			}
+		}
+
+		/* slot of the first value that is not less than v, or zero */
+		template <typename Tk>
+		slot lower_bound_slot(const Tk& v) const
+		{
+			size_t i = _LowerBound(v);
+			return i < _Keys.size() ? _Slots[i] : 0;
+		}
+
+		/* calls f(value, slot) for all values in sorted order */
+		template <typename Fn>
+		void foreach(Fn&& f) const { _Inorder(0, f); }
+
+		/* mutable set with the same values in the same slots */
+		set<Tu, Tc, Tt> thaw() const
+		{
+			std::vector<Tu> vals;
+			std::vector<slot> slots;
+
+			vals.reserve(_Cnt);
+			slots.reserve(_Cnt);
+
+			foreach([&](const Tu& v, slot s) { vals.push_back(v); slots.push_back(s); });
+
+			set<Tu, Tc, Tt> out(0, _Cmp);
+			out.assign_sorted_at(vals.begin(), vals.end(), slots.begin());
+
+			return out;
+		}
+
+	protected:
+
+		//descents interleaved by find_slots
+		static constexpr u32 LOOKUP_GROUP = 16;
+
+		/* number of keys in block k that are less than v */
+		template <typename Tk>
+		inline u32 _Rank(const Tu* keys, size_t k, const Tk& v) const
+		{
+			if constexpr (B == 1)
+				return _Cmp(keys[k], v) ? 1 : 0;
+			else
+				return _BlockRank<B, Tu, Tc>::Of(keys + k * B, (Tu)v, _Cmp);
+		}
+
+		/*
+			Position of the first key that is not less than v, size of the key array if none.
+
+			Blocks of many keys are not prefetched here: the next block is one of B + 1 and is known only after
+			the compare, and prefetching all of them costs more than it saves (see find_slots instead).
+		*/
+		template <typename Tk>
+		size_t _LowerBound(const Tk& v) const
+		{
+			const Tu* keys = _Keys.data();
+			size_t res = _Keys.size(), last = res - 1;
+
+			for (size_t k = 0; k < _Blocks; )
+			{
+				if constexpr (B == 1)
+				{
+					//near the leaves descendants are past the end of the array
+					_Prefetch(keys + std::min(PF * k + PF - 1, last));
+				}
+
+				u32 i = _Rank(keys, k, v);
+
+				res = i < B ? k * B + i : res;
+				k = k * (B + 1) + i + 1;
+			}
+
+			return res;
+		}
+
+		/* in-order walk over blocks, assigns sorted values */
+		void _Fill(size_t k, size_t& i, const Tu* sorted, const slot* slots)
+		{
+			if (k >= _Blocks)
+				return;
+
+			for (u32 j = 0; j <= B; ++j)
+			{
+				_Fill(k * (B + 1) + j + 1, i, sorted, slots);
+
+				if (j < B)
+				{
+					if (i < _Cnt)
+					{
+						_Keys[k * B + j] = sorted[i];
+						_Slots[k * B + j] = slots[i];
+					}
+					else if constexpr (WIDE)
+					{
+						_Keys[k * B + j] = _Padding();
+					}
+					++i;
+				}
+			}
+		}
+
+		/* largest float is less than stored infinity, so floating point keys are padded by infinity */
+		static constexpr Tu _Padding()
+		{
+			if constexpr (std::numeric_limits<Tu>::has_infinity)
+				return std::numeric_limits<Tu>::infinity();
+			else
+				return std::numeric_limits<Tu>::max();
+		}
+
+		template <typename Fn>
+		void _Inorder(size_t k, Fn& f) const
+		{
+			if (k >= _Blocks)
+				return;
+
+			for (u32 j = 0; j <= B; ++j)
+			{
+				_Inorder(k * (B + 1) + j + 1, f);
+
+				if (j < B && _Slots[k * B + j])
+				{
+					f(_Keys[k * B + j], _Slots[k * B + j]);
+				}
+			}
+		}
+
+
+		std::vector<Tu>		_Keys;
+		std::vector<slot>	_Slots;
+
+		size_t	_Cnt = { 0 };
+		size_t	_Blocks = { 0 };
+
+		Tc		_Cmp;
+	};
+
+}
+#endif
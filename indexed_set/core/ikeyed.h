@@ -0,0 +1,246 @@
+#ifndef __base2_core_ikeyed__
+#define __base2_core_ikeyed__
+
+#include "./iavl.h"
+
+namespace indexed
+{
+
+#pragma region Value array ...
+	/*
+		Array of values addressed by slot, grows on demand, slots never written read as zeroized values
+	*/
+	template <typename Tv, typename Tt = default_traits>
+	struct _SlotArray : protected _TreeBuffer<Tt>
+	{
+		using _Base = _TreeBuffer<Tt>;
+		using ulen = typename _Base::ulen;
+
+		static_assert(std::is_trivially_copyable<Tv>::value);
+
+		inline Tv* At(slot s) { return _Base::template _AsPtrOf<Tv>((ulen)(s * sizeof(Tv))); }
+		inline const Tv* At(slot s) const { return _Base::template _AsPtrOf<Tv>((ulen)(s * sizeof(Tv))); }
+
+		/* makes sure that the slot is present and returns it */
+		Tv* Ensure(slot s)
+		{
+			ulen need = _BytesThrough(s);
+
+			if (need > _Base::len_)
+			{
+				_Base::_PtrAppendZeroBytes(need - _Base::len_);
+			}
+
+			return At(s);
+		}
+
+		void Reserve(size_t ElementCount) { _Base::_Reserve(_BytesThrough(ElementCount)); }
+
+		inline size_t Count() const { return _Base::len_ / sizeof(Tv); }
+
+		void Clear() { _Base::_Reset(); }
+
+	protected:
+
+		/* bytes of values in slots 0 ... last, throws when they do not fit the length type */
+		static ulen _BytesThrough(size_t last)
+		{
+			if (last >= (size_t)(ulen)~ulen(0) / sizeof(Tv))
+				throw std::length_error("Growable length limit is reached");
+
+			return (ulen)((last + 1) * sizeof(Tv));
+		}
+	};
+#pragma endregion
+
+
+
+	/*
+		Set of records, ordered by the key of every record, which is given by Fk:
+			Tk operator()(const Tv& record) const
+
+		Tree nodes carry only keys and links, records are kept in a separate array, indexed by the same slots.
+		Lookups and insertions walk through compact nodes and touch exactly one record, at(slot) is O(1).
+
+		Records are never moved by insertions and erasures, slot of a record stays the same for its life time.
+	*/
+	template <typename Tk, typename Tv, typename Fk, typename Tc = std::less<Tk>, typename Tt = default_traits>
+	struct keyed_set : protected _AvlTree<Tk, Tc, Tt>
+	{
+		static_assert(std::is_trivially_copyable<Tk>::value);
+		static_assert(std::is_trivially_copyable<Tv>::value);
+
+		using _Base = typename _AvlTree<Tk, Tc, Tt>;
+		using _Iter = typename _Base::_Iter;
+		using off = typename _Base::off;
+
+		static constexpr slot ToSlot(off o) { return o ? (slot)(size_t(o) / _Base::Nsize()) : 0; }
+
+
+		/* walks records in the order of their keys */
+		struct iter
+		{
+			iter(_Iter it, keyed_set* s) : it_(it), s_(s) {}
+
+			inline operator bool() const { return it_ ? true : false; }
+			inline bool operator!=(const iter& o) { return it_ != o.it_; }
+
+			iter& operator++() { ++it_; return *this; }
+			iter& operator--() { --it_; return *this; }
+
+			const Tv& operator*() { return *s_->_Vals.At(slot_of()); }
+			const Tv* operator->() { return s_->_Vals.At(slot_of()); }
+
+			inline const Tk& key() { return *it_; }
+			inline slot slot_of() { return ToSlot(s_->Optr(it_.node())); }
+
+			_Iter		it_;
+			keyed_set*	s_;
+		};
+
+
+		keyed_set(size_t initialCount = 0, const Tc& cmp = Tc(), const Fk& keyOf = Fk()) : _Base(cmp), _KeyOf(keyOf)
+		{
+			if (initialCount)
+				reserve(initialCount);
+		}
+
+		keyed_set(const keyed_set&) = default;
+		keyed_set(keyed_set&&) = default;
+		keyed_set& operator=(const keyed_set&) = delete;
+		keyed_set& operator=(keyed_set&&) = delete;
+
+
+		inline size_t	size() const { return _Base::Size(); }
+		inline bool		empty() const { return 0 == size() ? true : false; }
+
+		inline void		reserve(size_t count)
+		{
+			_Base::Reserve(count);
+			_Vals.Reserve(count);
+		}
+
+		/* inserts the record if its key is not present yet, returns slot of the record with this key */
+		std::pair<slot, bool> insert(const Tv& r)
+		{
+			auto [o, added] = _Base::Insert(_KeyOf(r));
+			slot s = ToSlot(o);
+
+			if (added)
+			{
+				*_Vals.Ensure(s) = r;
+			}
+
+			return { s, added };
+		}
+
+		/* same as insert, but the record with equal key is replaced */
+		std::pair<slot, bool> insert_or_assign(const Tv& r)
+		{
+			auto [o, added] = _Base::Insert(_KeyOf(r));
+			slot s = ToSlot(o);
+
+			*_Vals.Ensure(s) = r;
+
+			return { s, added };
+		}
+
+		void erase(const Tk& k) { _Base::Erase(k); }
+		void erase_at(slot pos) { _Base::EraseAtOffset((off)(pos * _Base::Nsize())); }
+
+		slot find_slot(const Tk& k)
+		{
+			auto it = _Base::FindNode(k);
+			return it ? ToSlot(_Base::Optr(it.node())) : 0;
+		}
+
+		/* record with given key or null */
+		const Tv* find(const Tk& k)
+		{
+			slot s = find_slot(k);
+			return s ? _Vals.At(s) : nullptr;
+		}
+
+		inline const Tv& at(slot pos) const { return *_Vals.At(pos); }
+		inline const Tk& key_at(slot pos) { return *_Base::Tptr((off)(pos * _Base::Nsize())); }
+
+		iter begin() { return { _Base::Begin(), this }; }
+		iter end() { return { _Base::End(), this }; }
+
+		/* first record with the key that is not less than k */
+		iter lower_bound(const Tk& k) { return { _Iter::from_node(_Base::LowerBoundNode(k)), this }; }
+
+		/* first record with the key that is greater than k */
+		iter upper_bound(const Tk& k) { return { _Iter::from_node(_Base::UpperBoundNode(k)), this }; }
+
+		void clear()
+		{
+			_Base::Clear();
+			_Vals.Clear();
+		}
+
+		template <typename Fn>
+		void foreach(Fn&& f)
+		{
+			for (auto it = begin(); it; ++it)
+			{
+				f(*it);
+			}
+		}
+
+		/*
+			Rewrites the node buffer in the given layout (see set::optimize_layout), records follow their keys,
+			remap(old slot, new slot) is called for every record
+		*/
+		template <typename Fm>
+		void optimize_layout(Layout l, Fm&& remap)
+		{
+			std::vector<Tv> old(_Vals.Count());
+			if (!old.empty())
+			{
+				memcpy(old.data(), _Vals.At(0), old.size() * sizeof(Tv));
+			}
+
+			_Vals.Clear();
+
+			_Base::Relayout(l, [&](off from, off to)
+				{
+					*_Vals.Ensure(ToSlot(to)) = old[ToSlot(from)];
+					remap(ToSlot(from), ToSlot(to));
+				});
+		}
+
+		void optimize_layout(Layout l = Layout::VanEmdeBoas) { optimize_layout(l, [](slot, slot) {}); }
+
+
+#ifdef CHECKED_BUILD
+		void dbg_report(std::ostream& o = std::cout)
+		{
+			_Base::__LifeCheck(o);
+		}
+
+		/* tree integrity, and the key of every record matches its node */
+		bool dbg_validate()
+		{
+			if (!_Base::__ValidateIntegrity())
+				return false;
+
+			for (auto it = begin(); it; ++it)
+			{
+				if (_Base::_Cmp(it.key(), _KeyOf(*it)) || _Base::_Cmp(_KeyOf(*it), it.key()))
+					return false;
+			}
+
+			return true;
+		}
+#endif
+
+	protected:
+
+		_SlotArray<Tv, Tt>	_Vals;
+
+		Fk		_KeyOf;
+	};
+
+}
+#endif
@@ -0,0 +1,563 @@
+#ifndef __base2_core_imap__
+#define __base2_core_imap__
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//page-sharing snapshots need memory files and page table flags, which only Linux has
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+#define INDEXED_COW
+#endif
+
+namespace indexed
+{
+
+#pragma region File mapping ...
+	/*
+		How the file is mapped into memory:
+			ReadOnly	- the file is only read, any attempt to modify the content throws
+			Shared		- changes are written through to the file, the file grows together with the content
+			CopyOnWrite	- changes are private to the process, the file is never modified
+	*/
+	enum struct MapMode : uint8_t
+	{
+		ReadOnly = 1, Shared = 2, CopyOnWrite = 3
+	};
+
+	/*
+		Entire file mapped into memory, thin wrapper over mmap / MapViewOfFile
+	*/
+	struct _FileMap
+	{
+		using u8 = uint8_t;
+
+		_FileMap() {}
+		_FileMap(const _FileMap&) = delete;
+		_FileMap& operator=(const _FileMap&) = delete;
+		~_FileMap() { Close(); }
+
+		u8*		base = { nullptr };
+		size_t	size = { 0 };
+		MapMode	mode = { MapMode::ReadOnly };
+
+		bool Open(const char* path, MapMode m)
+		{
+			Close();
+			mode = m;
+
+#ifdef _WIN32
+			file_ = CreateFileA(path, GENERIC_READ | (m == MapMode::Shared ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+			LARGE_INTEGER sz;
+			if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &sz) || !sz.QuadPart)
+			{
+				Close();
+				return false;
+			}
+
+			size = (size_t)sz.QuadPart;
+#else
+			fd_ = open(path, m == MapMode::Shared ? O_RDWR : O_RDONLY);
+
+			struct stat st;
+			if (fd_ < 0 || fstat(fd_, &st) || !st.st_size)
+			{
+				Close();
+				return false;
+			}
+
+			size = (size_t)st.st_size;
+#endif
+			if (!_Map())
+			{
+				Close();
+				return false;
+			}
+
+			return true;
+		}
+
+		/* changes size of Shared mapping together with the file, added bytes are zeroized; the base can move */
+		bool Resize(size_t newSize)
+		{
+			if (mode != MapMode::Shared || !base)
+				return false;
+
+			size_t oldSize = size;
+
+#ifdef _WIN32
+			_Unmap();
+
+			LARGE_INTEGER sz;
+			sz.QuadPart = (LONGLONG)newSize;
+			if (!SetFilePointerEx(file_, sz, nullptr, FILE_BEGIN) || !SetEndOfFile(file_))
+				return false;
+
+			size = newSize;
+			if (!_Map())
+				return false;
+
+			//extended part of the file is not guaranteed to be zero on Windows
+			if (newSize > oldSize)
+			{
+				memset(base + oldSize, 0, newSize - oldSize);
+			}
+#else
+			if (ftruncate(fd_, (off_t)newSize))
+				return false;
+
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+			void* p = mremap(base, oldSize, newSize, MREMAP_MAYMOVE);
+			if (p == MAP_FAILED)
+				return false;
+
+			base = (u8*)p;
+			size = newSize;
+#else
+			_Unmap();
+
+			size = newSize;
+			if (!_Map())
+				return false;
+#endif
+			(void)oldSize;
+#endif
+			return true;
+		}
+
+#ifndef _WIN32
+		/* takes ownership of n bytes mapped at p (by mmap) as read-only content */
+		void AdoptView(u8* p, size_t n)
+		{
+			Close();
+
+			base = p;
+			size = n;
+			mode = MapMode::ReadOnly;
+		}
+#endif
+
+		/* writes modified pages of Shared mapping to the file */
+		void Flush()
+		{
+			if (!base || mode != MapMode::Shared)
+				return;
+
+#ifdef _WIN32
+			FlushViewOfFile(base, 0);
+			FlushFileBuffers(file_);
+#else
+			msync(base, size, MS_SYNC);
+#endif
+		}
+
+		void Close()
+		{
+			_Unmap();
+
+#ifdef _WIN32
+			if (file_ != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file_);
+				file_ = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (fd_ >= 0)
+			{
+				close(fd_);
+				fd_ = -1;
+			}
+#endif
+			size = 0;
+		}
+
+	protected:
+
+		bool _Map()
+		{
+#ifdef _WIN32
+			DWORD prot = mode == MapMode::ReadOnly ? PAGE_READONLY : (mode == MapMode::Shared ? PAGE_READWRITE : PAGE_WRITECOPY);
+			DWORD access = mode == MapMode::ReadOnly ? FILE_MAP_READ : (mode == MapMode::Shared ? FILE_MAP_WRITE : FILE_MAP_COPY);
+
+			section_ = CreateFileMappingA(file_, nullptr, prot, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+			if (!section_)
+				return false;
+
+			base = (u8*)MapViewOfFile(section_, access, 0, 0, size);
+#else
+			int prot = mode == MapMode::ReadOnly ? PROT_READ : (PROT_READ | PROT_WRITE);
+			int flags = mode == MapMode::CopyOnWrite ? MAP_PRIVATE : MAP_SHARED;
+
+			void* p = mmap(nullptr, size, prot, flags, fd_, 0);
+			base = p == MAP_FAILED ? nullptr : (u8*)p;
+#endif
+			return base != nullptr;
+		}
+
+		void _Unmap()
+		{
+#ifdef _WIN32
+			if (base)
+			{
+				UnmapViewOfFile(base);
+			}
+			if (section_)
+			{
+				CloseHandle(section_);
+				section_ = nullptr;
+			}
+#else
+			if (base)
+			{
+				munmap(base, size);
+			}
+#endif
+			base = nullptr;
+		}
+
+#ifdef _WIN32
+		HANDLE	file_ = { INVALID_HANDLE_VALUE };
+		HANDLE	section_ = { nullptr };
+#else
+		int		fd_ = { -1 };
+#endif
+	};
+
+#pragma endregion
+
+#pragma region Memory backends ...
+	/*
+		Backend provides memory to _Growable:
+			Granularity						- capacity is always rounded up to it
+			Allocate(cap)					- returns zeroized block or nullptr
+			Grow(p, used, oldCap, newCap)	- returns block of newCap bytes with the first 'used' bytes kept and the rest
+											  zeroized, or nullptr (old block stays valid); bytes of the old block past
+											  'used' are zero already
+			Release(p, cap)
+	*/
+
+	/* malloc'ed memory, every growth copies the content and clears the added tail */
+	struct heap_backend
+	{
+		using u8 = uint8_t;
+
+		static constexpr size_t Granularity = 1;
+
+		static u8* Allocate(size_t cap) { return (u8*)calloc(1, cap); }
+
+		static u8* Grow(u8* p, size_t used, size_t oldCap, size_t newCap)
+		{
+			u8* _Moved = (u8*)malloc(newCap);
+
+			if (!_Moved)
+				return nullptr;
+
+			if (used)
+			{
+				memcpy(_Moved, p, used);
+			}
+			memset(_Moved + used, 0, newCap - used);
+
+			Release(p, oldCap);
+			return _Moved;
+		}
+
+		static void Release(u8* p, size_t) { free(p); }
+	};
+
+	/*
+		Anonymous memory mapping. Pages come zeroized from the system and are touched only when used,
+		on Linux the mapping grows by mremap, which moves page tables instead of copying the content.
+
+		HugePages asks the kernel to back the memory with transparent huge pages (Linux only, ignored elsewhere),
+		which cuts TLB misses of random access into large sets.
+	*/
+	template <bool HugePages = false>
+	struct mmap_backend
+	{
+		using u8 = uint8_t;
+
+		static constexpr size_t Granularity = HugePages ? (2u << 20) : 4096;
+
+		static u8* Allocate(size_t cap)
+		{
+#ifdef _WIN32
+			return (u8*)VirtualAlloc(nullptr, cap, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+			void* p = mmap(nullptr, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				return nullptr;
+
+			_Advise(p, cap);
+			return (u8*)p;
+#endif
+		}
+
+		static u8* Grow(u8* p, size_t used, size_t oldCap, size_t newCap)
+		{
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+			(void)used;
+
+			void* _Moved = mremap(p, oldCap, newCap, MREMAP_MAYMOVE);
+			if (_Moved == MAP_FAILED)
+				return nullptr;
+
+			_Advise(_Moved, newCap);
+			return (u8*)_Moved;
+#else
+			//no way to remap, but the added tail still comes zeroized from the system
+			u8* _Moved = Allocate(newCap);
+			if (!_Moved)
+				return nullptr;
+
+			if (used)
+			{
+				memcpy(_Moved, p, used);
+			}
+
+			Release(p, oldCap);
+			return _Moved;
+#endif
+		}
+
+		static void Release(u8* p, size_t cap)
+		{
+#ifdef _WIN32
+			(void)cap;
+			VirtualFree(p, 0, MEM_RELEASE);
+#else
+			munmap(p, cap);
+#endif
+		}
+
+	protected:
+
+#ifndef _WIN32
+		static void _Advise(void* p, size_t cap)
+		{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+			if constexpr (HugePages)
+			{
+				madvise(p, cap, MADV_HUGEPAGE);
+			}
+#endif
+			(void)p; (void)cap;
+		}
+#endif
+	};
+
+#ifdef INDEXED_COW
+	/*
+		Memory file (memfd) mapped into memory, with copy-on-write views: Snapshot(p, used, cap) maps the same file
+		once more as read-only view, and switches the block itself to private mapping of the file. From then on the
+		file is frozen, and the kernel copies pages of the block one by one, as the owner modifies them.
+
+		Every next view maps the frozen file too, and copies only the pages that the block has modified since (they are
+		found in /proc/self/pagemap). When those grow past a quarter of the block, its content moves into a new file.
+
+		The first page of the mapping keeps the descriptor of the file, the block starts right after it.
+	*/
+	struct cow_backend
+	{
+		using u8 = uint8_t;
+
+		static constexpr size_t Granularity = 4096;
+
+		static u8* Allocate(size_t cap)
+		{
+			int fd = memfd_create("indexed", MFD_CLOEXEC);
+			if (fd < 0)
+				return nullptr;
+
+			u8* p = _Map(fd, cap, MAP_SHARED, nullptr);
+			if (!p)
+			{
+				close(fd);
+				return nullptr;
+			}
+
+			_Hdr(p)->fd = fd;
+			return p;
+		}
+
+		static u8* Grow(u8* p, size_t used, size_t oldCap, size_t newCap)
+		{
+			(void)used;
+
+			//extending the file does not change the views, they never map past their length
+			if (ftruncate(_Hdr(p)->fd, (off_t)(PAGE + newCap)))
+				return nullptr;
+
+			void* _Moved = mremap(p - PAGE, PAGE + oldCap, PAGE + newCap, MREMAP_MAYMOVE);
+			if (_Moved == MAP_FAILED)
+				return nullptr;
+
+			return (u8*)_Moved + PAGE;
+		}
+
+		static void Release(u8* p, size_t cap)
+		{
+			int fd = _Hdr(p)->fd;
+
+			munmap(p - PAGE, PAGE + cap);
+			close(fd);
+		}
+
+		/* read-only view of the first 'used' bytes of the block, as they are now, or null */
+		static _FileMap* Snapshot(u8* p, size_t used, size_t cap)
+		{
+			_Header* h = _Hdr(p);
+			size_t pages = std::max<size_t>(1, (used + PAGE - 1) / PAGE);
+
+			std::vector<size_t> dirty;
+
+			if (!h->frozen)
+			{
+				//same pages, now private to the block
+				if (!_Map(h->fd, cap, MAP_PRIVATE, p))
+					return nullptr;
+
+				h->frozen = true;
+			}
+			else if (!_Dirty(p, pages, dirty) || dirty.size() > cap / PAGE / 4)
+			{
+				if (!_Refile(p, used, cap))
+					return nullptr;
+
+				dirty.clear();
+			}
+
+			void* v = mmap(nullptr, pages * PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE, h->fd, PAGE);
+			if (v == MAP_FAILED)
+				return nullptr;
+
+			for (size_t i : dirty)
+			{
+				memcpy((u8*)v + i * PAGE, p + i * PAGE, PAGE);
+			}
+
+			if (mprotect(v, pages * PAGE, PROT_READ))
+			{
+				munmap(v, pages * PAGE);
+				return nullptr;
+			}
+
+			_FileMap* m = new _FileMap();
+			m->AdoptView((u8*)v, pages * PAGE);
+
+			return m;
+		}
+
+	protected:
+
+		static constexpr size_t PAGE = 4096;
+
+		struct _Header
+		{
+			int		fd;
+			bool	frozen;
+		};
+
+		static inline _Header* _Hdr(u8* p) { return (_Header*)(p - PAGE); }
+
+		/* maps the file behind the header page, over the given block if any, returns the block or null */
+		static u8* _Map(int fd, size_t cap, int flags, u8* at)
+		{
+			if (!at && ftruncate(fd, (off_t)(PAGE + cap)))
+				return nullptr;
+
+			void* b = mmap(at ? at - PAGE : nullptr, PAGE + cap, PROT_READ | PROT_WRITE, flags | (at ? MAP_FIXED : 0), fd, 0);
+
+			return b == MAP_FAILED ? nullptr : (u8*)b + PAGE;
+		}
+
+		/* pages of the block that are no longer the pages of the file, false if the page table is not readable */
+		static bool _Dirty(const u8* p, size_t pages, std::vector<size_t>& out)
+		{
+			int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				return false;
+
+			std::vector<uint64_t> e(pages);
+
+			size_t want = pages * sizeof(uint64_t);
+			bool ok = pread(fd, e.data(), want, (off_t)((uintptr_t)p / PAGE * sizeof(uint64_t))) == (ssize_t)want;
+
+			close(fd);
+
+			//present (63) or swapped (62) page, which is not a page of the file (61), is a private copy
+			for (size_t i = 0; ok && i < pages; ++i)
+			{
+				if ((e[i] >> 62) && !((e[i] >> 61) & 1))
+				{
+					out.push_back(i);
+				}
+			}
+
+			return ok;
+		}
+
+		/* moves the content into a new file, which the block maps privately */
+		static bool _Refile(u8* p, size_t used, size_t cap)
+		{
+			int fd = memfd_create("indexed", MFD_CLOEXEC);
+			if (fd < 0 || ftruncate(fd, (off_t)(PAGE + cap)))
+			{
+				if (fd >= 0)
+					close(fd);
+				return false;
+			}
+
+			for (size_t done = 0; done < PAGE + used; )
+			{
+				ssize_t w = pwrite(fd, p - PAGE + done, PAGE + used - done, (off_t)done);
+				if (w <= 0)
+				{
+					close(fd);
+					return false;
+				}
+				done += (size_t)w;
+			}
+
+			int old = _Hdr(p)->fd;
+
+			if (!_Map(fd, cap, MAP_PRIVATE, p))
+			{
+				close(fd);
+				return false;
+			}
+
+			_Hdr(p)->fd = fd;
+			close(old);
+
+			return true;
+		}
+	};
+#endif
+
+#pragma endregion
+
+}
+
+#endif
@@ -12,6 +12,23 @@
 #include <algorithm>
 #include <functional>
 #include <iostream>
+#include <type_traits>
+#include <utility>
+#include <stdexcept>
+
+#include "./imap.h"
+
+#ifdef __cpp_impl_three_way_comparison
+#include <compare>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace indexed
 {
@@ -48,23 +65,150 @@ namespace indexed
 
 	//for pipelining (a concatenation) of two consecutive rotation
 	inline Dir2 operator|(Dir a, Dir b) { return (Dir2)((((uint8_t)a) << 2) + (uint8_t)b); }
+
+	/* asks the processor to start loading the cache line with given address, does nothing where not supported */
+	inline void _Prefetch(const void* p)
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_prefetch((const char*)p, _MM_HINT_T0);
+#elif defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(p);
+#else
+		(void)p;
+#endif
+	}
+
+	/* index of the lowest set bit, m must not be zero */
+	inline uint32_t _LowestBit(uint32_t m)
+	{
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward(&i, m);
+		return (uint32_t)i;
+#else
+		return (uint32_t)__builtin_ctz(m);
+#endif
+	}
+
+	/*
+		Tilt bytes of 16 nodes, Stride bytes apart, starting at t: bit i is set when node i is in use (its tilt is not zero).
+		Building the mask has no branches, visiting its set bits has no mispredictions on randomly placed holes.
+	*/
+	inline uint32_t _LiveMask16(const uint8_t* t, size_t Stride)
+	{
+		uint32_t m = 0;
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			m |= (t[i * Stride] ? 1u : 0u) << i;
+		}
+		return m;
+	}
+#pragma endregion
+
+#pragma region Comparison ...
+	/*
+		Three-way comparator is any comparator that, in addition to 'less' operator(), has a member
+			int compare(const A& a, const B& b) const
+		returning negative, zero or positive value, same as strcmp.
+	*/
+	template <typename Tc, typename Ta, typename Tb, typename = void>
+	struct _HasCompare : std::false_type {};
+
+	template <typename Tc, typename Ta, typename Tb>
+	struct _HasCompare<Tc, Ta, Tb, decltype((void)(int)std::declval<const Tc&>().compare(std::declval<const Ta&>(), std::declval<const Tb&>()))> : std::true_type {};
+
+	/* std::less can be replaced by operator<=> (if compiler supports it) */
+	template <typename Tc>
+	struct _IsStdLess : std::false_type {};
+
+	template <typename T>
+	struct _IsStdLess<std::less<T>> : std::true_type {};
+
+	/* built-in operators, where < and <=> cannot disagree */
+	template <typename T>
+	struct _IsBuiltinOrdered : std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value> {};
+
+#ifdef __cpp_impl_three_way_comparison
+	/*
+		Opt-in three-way comparator for class types, descends with one operator<=> per node.
+		It must only be used when operator<=> of T agrees with operator<, std::less never switches to it by itself.
+	*/
+	template <typename T>
+	struct three_way_less : std::less<T>
+	{
+		inline int compare(const T& a, const T& b) const
+		{
+			auto r = a <=> b;
+			return r < 0 ? -1 : (r > 0 ? 1 : 0);
+		}
+	};
+#endif
+
+	/*
+		Returns negative, zero or positive value, when a is less, equal or greater than b.
+
+		Takes one comparator call if it is three-way comparator, or std::less over arithmetic and enum types
+		(one built-in operator<=>), otherwise falls back to two calls of 'less'. Class types keep their operator<
+		under std::less, even if they have operator<=>, see three_way_less.
+	*/
+	template <typename Tc, typename Ta, typename Tb>
+	inline int _Compare3(const Tc& cmp, const Ta& a, const Tb& b)
+	{
+		if constexpr (_HasCompare<Tc, Ta, Tb>::value)
+		{
+			return (int)cmp.compare(a, b);
+		}
+#ifdef __cpp_impl_three_way_comparison
+		else if constexpr (_IsStdLess<Tc>::value && _IsBuiltinOrdered<Ta>::value && _IsBuiltinOrdered<Tb>::value && std::three_way_comparable_with<Ta, Tb>)
+		{
+			auto r = a <=> b;
+			return r < 0 ? -1 : (r > 0 ? 1 : 0);
+		}
+#endif
+		else
+		{
+			return cmp(a, b) ? -1 : (cmp(b, a) ? 1 : 0);
+		}
+	}
 #pragma endregion
 
 #pragma region Growable ...
+	/* backend that can give read-only view of a block, sharing its pages (see cow_backend) */
+	template <typename Tb, typename = void>
+	struct _CanSnapshot : std::false_type {};
+
+	template <typename Tb>
+	struct _CanSnapshot<Tb, decltype((void)Tb::Snapshot(nullptr, 0, 0))> : std::true_type {};
+
 	/*
 		This growable array operates on bytes only
-		Growth happens by at least MIN_GROW_BY bytes or at most requested count, aligned by Ta size
+		Growth happens by the largest of MIN_GROW_BY bytes, requested count or GROW_PCT percent of current capacity,
+		aligned by Ta size and by granularity of the backend Tb
+
+		Memory is either provided by the backend, or belongs to a mapped file. Shared file mapping grows together with
+		the file, copy-on-write mapping moves to backend memory on the first growth, read-only mapping cannot grow.
+
+		Bytes past the used length are always zero. Tl is the type of length and capacity, uint32_t or uint64_t.
 	*/
-	template <uint32_t MIN_GROW_BY = 1024, uint32_t Ta = 16>
+	template <uint32_t MIN_GROW_BY = 1024, uint32_t Ta = 16, typename Tb = heap_backend, uint32_t GROW_PCT = 50, typename Tl = uint32_t>
 	struct _Growable
 	{
 		static_assert(MIN_GROW_BY > 0);
 		static_assert(((~(Ta - 1))& Ta) == Ta, "ERR: Only one bit must be set in aligment size");
 
-		static constexpr uint32_t Aligned(uint64_t n) { return (n + (Ta - 1)) & (~(Ta - 1)); }
+		static_assert(((~(Tb::Granularity - 1))& Tb::Granularity) == Tb::Granularity, "ERR: Backend granularity must be a power of two");
+
+		static_assert(std::is_unsigned<Tl>::value && sizeof(Tl) >= sizeof(uint32_t), "ERR: Length must be unsigned, 32 or 64 bits");
+
+		static constexpr uint64_t Aligned(uint64_t n)
+		{
+			constexpr uint64_t _A = std::max<uint64_t>(Ta, Tb::Granularity);
+			return (n + (_A - 1)) & (~(_A - 1));
+		}
 
 		using u8 = uint8_t;
 		using u32 = uint32_t;
+		using ulen = Tl;
 
 
 		_Growable() {}
@@ -72,11 +216,17 @@ namespace indexed
 		{
 			if (o.ptr_)
 			{
-				ptr_ = (u8*)malloc(o.capacity_);
-				memcpy(ptr_, o.ptr_, o.capacity_);
+				ulen _Cap = (ulen)Aligned(o.capacity_);
+
+				ptr_ = Tb::Allocate(_Cap);
+
+				if (!ptr_)
+					throw std::bad_alloc();
+
+				memcpy(ptr_, o.ptr_, o.len_);
 
 				len_ = o.len_;
-				capacity_ = o.capacity_;
+				capacity_ = _Cap;
 			}
 		}
 
@@ -87,9 +237,13 @@ namespace indexed
 				ptr_ = o.ptr_;
 				len_ = o.len_;
 				capacity_ = o.capacity_;
+				map_ = o.map_;
+				readonly_ = o.readonly_;
 
 				o.ptr_ = nullptr;
+				o.map_ = nullptr;
 				o.len_ = o.capacity_ = 0;
+				o.readonly_ = false;
 			}
 		}
 		_Growable& operator=(const _Growable&) = delete;
@@ -98,21 +252,21 @@ namespace indexed
 		~_Growable() { _Reset(); }
 
 
-		inline u32	_Size() const { return len_; }
-		inline u32	_Capacity() const { return capacity_; }
+		inline ulen	_Size() const { return len_; }
+		inline ulen	_Capacity() const { return capacity_; }
 
 		inline u8* _Head() { return ptr_; }
 		inline const u8* _Head() const { return ptr_; }
 
 
-		inline u8* _PtrOf(u32 offset) { return ptr_ + offset; }
-		inline const u8* _PtrOf(u32 offset) const { return ptr_ + offset; }
+		inline u8* _PtrOf(ulen offset) { return ptr_ + offset; }
+		inline const u8* _PtrOf(ulen offset) const { return ptr_ + offset; }
 
 		template <typename To>
-		To* _AsPtrOf(u32 offset) { return (To*)(ptr_ + offset); }
+		To* _AsPtrOf(ulen offset) { return (To*)(ptr_ + offset); }
 
 		template <typename To>
-		const To* _AsPtrOf(u32 offset) const { return (To*)(ptr_ + offset); }
+		const To* _AsPtrOf(ulen offset) const { return (To*)(ptr_ + offset); }
 
 
 
@@ -125,21 +279,21 @@ namespace indexed
 		*/
 #pragma region Append -> Ptr ...
 
-		u8* _PtrAppendBytes(const void* src, u32 cnt)
+		u8* _PtrAppendBytes(const void* src, ulen cnt)
 		{
 			u8* _At = _GrowBy(cnt);
 
 			memcpy(_At, src, cnt);
 
-			len_ += (u32)cnt;
+			len_ += (ulen)cnt;
 
 			return _At;
 		}
 
-		u8* _PtrAppendZeroBytes(u32 cnt)
+		u8* _PtrAppendZeroBytes(ulen cnt)
 		{
 			u8* _At = _GrowBy(cnt);
-			len_ += (u32)cnt;
+			len_ += (ulen)cnt;
 			return _At;
 		}
 
@@ -179,18 +333,63 @@ namespace indexed
 
 	protected:
 
-		/* releases allocated memory */
+		/* releases allocated memory or unmaps the file */
 		void _Reset()
 		{
-			if (ptr_)
+			if (map_)
+			{
+				delete map_;
+				map_ = nullptr;
+			}
+			else if (ptr_)
 			{
-				free(ptr_);
-				ptr_ = nullptr;
-				len_ = capacity_ = 0;
+				Tb::Release(ptr_, capacity_);
 			}
+
+			ptr_ = nullptr;
+			len_ = capacity_ = 0;
+			readonly_ = false;
 		}
 
-		void _Reserve(u32 totalBytes)
+		/*
+			Releases current memory and takes ownership of the mapped file, where content starts Skip bytes
+			from the beginning of the file and Used bytes are already in use
+		*/
+		void _AdoptMapping(_FileMap* m, ulen Skip, ulen Used)
+		{
+			_Reset();
+
+			map_ = m;
+			ptr_ = m->base + Skip;
+			len_ = Used;
+			capacity_ = (ulen)(m->size - Skip);
+		}
+
+		inline _FileMap* _Mapping() const { return map_; }
+
+		/* throws if the content cannot be modified */
+		inline void _CheckWritable() const
+		{
+			if (readonly_ || (map_ && map_->mode == MapMode::ReadOnly))
+				throw std::runtime_error("Read-only mapping cannot be modified");
+		}
+
+		/* makes any further modification throw, until the content is released */
+		inline void _SetReadOnly() { readonly_ = true; }
+
+		/* read-only view of used bytes as they are now, which shares pages with the buffer, or null if it cannot */
+		_FileMap* _View()
+		{
+			if constexpr (_CanSnapshot<Tb>::value)
+			{
+				if (ptr_ && !map_)
+					return Tb::Snapshot(ptr_, len_, capacity_);
+			}
+
+			return nullptr;
+		}
+
+		void _Reserve(ulen totalBytes)
 		{
 			if (totalBytes > capacity_)
 			{
@@ -199,36 +398,69 @@ namespace indexed
 		}
 
 		/* Always returns a pointer where bytes can be appended. In case there is no memory available throws OutOfMemory */
-		u8* _GrowBy(u32 bytesToAdd)
+		u8* _GrowBy(ulen bytesToAdd)
 		{
 			if ((capacity_ - len_) < bytesToAdd)
 			{
-				u32 _NewCap = Aligned(std::max<uint64_t>({ (bytesToAdd - (capacity_ - len_)), MIN_GROW_BY, capacity_ / 2 }) + capacity_);
-
-				u8* _Moved = (u8*)malloc(_NewCap);
+				uint64_t _Want = Aligned(std::max<uint64_t>({ (bytesToAdd - (capacity_ - len_)), MIN_GROW_BY, (uint64_t)capacity_ * GROW_PCT / 100 }) + capacity_);
 
-				if (!_Moved)
-					throw std::bad_alloc();
+				_CheckWritable();
 
-				//copy old stuff
-				if (len_)
+				//at the very limit of the length type growth is cut to exactly what is requested
+				if (_Want > (uint64_t)(ulen)~ulen(0))
 				{
-					memcpy(_Moved, ptr_, len_);
+					_Want = (uint64_t)len_ + bytesToAdd;
+
+					if (_Want > (uint64_t)(ulen)~ulen(0))
+						throw std::length_error("Growable length limit is reached");
 				}
 
-				//zeroize added chunk
-				if (_NewCap > len_)
+				ulen _NewCap = (ulen)_Want;
+
+				if (map_ && map_->mode == MapMode::Shared)
 				{
-					memset(_Moved + len_, 0, _NewCap - len_);
+					//the file grows in place, the mapping may move
+					size_t _Skip = ptr_ - map_->base;
+
+					if (!map_->Resize(_Skip + _NewCap))
+						throw std::bad_alloc();
+
+					ptr_ = map_->base + _Skip;
+					capacity_ = _NewCap;
+
+#ifdef CHECKED_BUILD
+					++Reallocs_;
+#endif
+					return ptr_ + len_;
 				}
 
-				//clear
-				if (ptr_)
+				u8* _Moved = nullptr;
+
+				if (map_)
+				{
+					//private copy of the mapped file moves to the backend memory
+					_Moved = Tb::Allocate(_NewCap);
+
+					if (!_Moved)
+						throw std::bad_alloc();
+
+					memcpy(_Moved, ptr_, len_);
+
+					delete map_;
+					map_ = nullptr;
+				}
+				else if (ptr_)
+				{
+					_Moved = Tb::Grow(ptr_, len_, capacity_, _NewCap);
+				}
+				else
 				{
-					free(ptr_);
-					ptr_ = nullptr;
+					_Moved = Tb::Allocate(_NewCap);
 				}
 
+				if (!_Moved)
+					throw std::bad_alloc();
+
 				//new values
 				ptr_ = _Moved;
 				capacity_ = _NewCap;
@@ -257,7 +489,13 @@ namespace indexed
 	protected:
 
 		u8* ptr_ = { nullptr };
-		u32		len_ = { 0 }, capacity_ = { 0 };
+		ulen		len_ = { 0 }, capacity_ = { 0 };
+
+		//not null when memory belongs to the mapped file
+		_FileMap* map_ = { nullptr };
+
+		//read-only copy (see _SetReadOnly), copies made of it are writable
+		bool		readonly_ = { false };
 
 #ifdef CHECKED_BUILD
 		u32		Reallocs_ = { 0 };
@@ -270,6 +508,59 @@ namespace indexed
 
 
 
+#pragma region Traits ...
+	/*
+		Compile-time options of the tree. Custom options are declared by deriving from default_traits and
+		overriding selected members.
+
+		counted			- every node keeps the number of nodes in its subtree, which enables order-statistic
+						  queries (n-th element, rank of a value, range counts) in O(log n) at the cost of 4 bytes per node
+		backend			- where node memory comes from: heap_backend (malloc) or mmap_backend<HugePages>, the latter
+						  grows without copying on Linux and suits large sets, or cow_backend (Linux only), which makes
+						  set::snapshot() share pages instead of copying them
+		growth_percent	- how much capacity is added on every reallocation, in percents of current capacity
+		offset			- signed type of node references, which limits total size of all nodes: int32_t allows 2 GB,
+						  int64_t lifts the limit for 4 bytes per reference, int16_t keeps nodes compact in sets
+						  below 32 KB
+	*/
+	struct default_traits
+	{
+		static constexpr bool counted = false;
+
+		using backend = heap_backend;
+		static constexpr uint32_t growth_percent = 50;
+
+		using offset = int32_t;
+	};
+
+	struct counted_traits : default_traits
+	{
+		static constexpr bool counted = true;
+	};
+
+	struct large_traits : default_traits
+	{
+		using offset = int64_t;
+	};
+
+	struct small_traits : default_traits
+	{
+		using offset = int16_t;
+	};
+
+	/* optional per-node subtree size, empty unless requested by traits */
+	template <bool Counted>
+	struct _NodeCount {};
+
+	template <>
+	struct _NodeCount<true>
+	{
+		uint32_t	count;
+	};
+#pragma endregion
+
+
+
 #pragma region INODE ...
 	/*
 		Node for binary tree.
@@ -277,17 +568,24 @@ namespace indexed
 		Keeps references of its parent, and two immediate chilren - left and right.
 		Reference is a signed byte distance from 'this' to another node
 
-		For now using 32-bit values to store these references, so no more than 2G distance is allowed
+		Type of references is given by Tt::offset (32-bit by default), so no more than 2G distance is allowed,
+		unless wider offsets are requested
 
 		Carried type Tu must implement copy-constructor, Tu destructor is properly called when the node is deleted.
 
+		When Tt::counted is set, the node also carries the size of its subtree, maintained by every insertion,
+		erasure and rotation.
+
 	*/
-	template <typename Tu, typename Tc = std::less<Tu>>
-	struct inode
+	template <typename Tu, typename Tc = std::less<Tu>, typename Tt = default_traits>
+	struct inode : _NodeCount<Tt::counted>
 	{
 		using u8 = typename uint8_t;
 		using u32 = typename uint32_t;
 
+		using off = typename Tt::offset;
+		static_assert(std::is_signed<off>::value && std::is_integral<off>::value, "ERR: Offset must be signed integer");
+
 		Tu payload;
 
 		mutable off parent, left, right;
@@ -327,6 +625,29 @@ namespace indexed
 
 		inline Dir		Branch() { return parent ? (Nparent()->left == (-parent) ? Dir::Left : Dir::Right) : Dir::None; }
 
+		//Subtree sizes, only available for counted nodes
+		inline static u32	CountOf(nptr_c n) { return n ? n->count : 0; }
+
+		inline void		_Recount()
+		{
+			if constexpr (Tt::counted)
+			{
+				this->count = 1 + CountOf(NSafeLeft()) + CountOf(NSafeRight());
+			}
+		}
+
+		/* adds delta to subtree size of this node and all nodes above it */
+		inline void		_CountUp(int32_t delta)
+		{
+			if constexpr (Tt::counted)
+			{
+				for (nptr n = this; n; n = n->NSafeParent())
+				{
+					n->count += delta;
+				}
+			}
+		}
+
 		inline nptr	Root()
 		{
 			nptr n = this;
@@ -343,27 +664,81 @@ namespace indexed
 			return tilt == Dir::Left ? _Ptr(left) : _Ptr(right);
 		}
 
-		void Inorder(std::function<void(const Tu&)> cb)
+		/*
+			Traversals of the subtree under this node, iterative, going up by parent links, so neither
+			the stack nor the heap is used. Callbacks are inlined, links must not be changed by them.
+		*/
+
+		/* in-order, calls cb(node, depth), where depth is counted from this node */
+		template <typename Fn>
+		void InorderNodes(Fn&& cb)
 		{
-			if (left)
-				Nleft()->Inorder(cb);
+			u32 d = 0;
+			nptr n = this;
+
+			for (; n->left; ++d)
+				n = n->Nleft();
+
+			for (;;)
+			{
+				cb(n, d);
 
-			cb(payload);
+				if (n->right)
+				{
+					for (n = n->Nright(), ++d; n->left; ++d)
+						n = n->Nleft();
+				}
+				else
+				{
+					//climb while coming from the right
+					for (; n != this && n->Branch() == Dir::Right; --d)
+						n = n->Nparent();
 
-			if (right)
-				Nright()->Inorder(cb);
+					if (n == this)
+						return;
+
+					n = n->Nparent();
+					--d;
+				}
+			}
+		}
+
+		template <typename Fn>
+		void Inorder(Fn&& cb)
+		{
+			InorderNodes([&](nptr n, u32) { cb(n->payload); });
 		}
 
-		void Enumerate(std::function<void(nptr)> cb)
+		/* post-order, children are visited before their parent, so cb can destroy the payload */
+		template <typename Fn>
+		void Enumerate(Fn&& cb)
 		{
-			if (left)
-				Nleft()->Enumerate(cb);
+			auto firstOf = [](nptr n)
+			{
+				for (;;)
+				{
+					if (n->left)
+						n = n->Nleft();
+					else if (n->right)
+						n = n->Nright();
+					else
+						return n;
+				}
+			};
 
-			if (right)
-				Nright()->Enumerate(cb);
+			for (nptr n = firstOf(this), next = nullptr; ; n = next)
+			{
+				if (n != this)
+				{
+					nptr P = n->Nparent();
+					next = (n->Branch() == Dir::Left && P->right) ? firstOf(P->Nright()) : P;
+				}
 
-			cb(this);
+				cb(n);
 
+				if (n == this)
+					break;
+			}
 		}
 
 		u32 Depth() const
@@ -380,19 +755,30 @@ namespace indexed
 			return d;
 		}
 
+		/* number of levels in the subtree under this node, found by walking down the heavier side */
+		u32 Height() const
+		{
+			u32 h = 0;
+
+			for (nptr_c n = this; n; n = (n->tilt == Dir::Right) ? n->NSafeRight() : n->NSafeLeft())
+			{
+				++h;
+			}
+
+			return h;
+		}
+
 		inline void __DestroyPayload()
 		{
 			payload.~Tu();
 		}
 
-		void DestroyRecursive()
+		void DestroySubtree()
 		{
-			__DestroyPayload();
-
-			if (left)
-				Nleft()->DestroyRecursive();
-			if (right)
-				Nright()->DestroyRecursive();
+			if constexpr (!std::is_trivially_destructible<Tu>::value)
+			{
+				Enumerate([](nptr n) { n->__DestroyPayload(); });
+			}
 		}
 
 
@@ -403,10 +789,13 @@ namespace indexed
 			(where == Dir::Left ? left : right) = _Off(this, child);
 			child->parent = _Off(child, this);
 
+			_CountUp(1);
+
 			Retrace_Insert(this, where);
 		}
 
-		static void Retrace_Insert(nptr n, Dir added)
+		/* repairs the tree after the subtree on 'added' side of n became one level higher, returns true if the whole tree did */
+		static bool Retrace_Insert(nptr n, Dir added)
 		{
 			while (n)
 			{
@@ -427,12 +816,14 @@ namespace indexed
 						_Rotate_Insert(n);
 					}
 
-					break;
+					return false;
 				}
 
 				n = n->NSafeParent();
 
 			}
+
+			return true;
 		}
 
 
@@ -554,31 +945,7 @@ namespace indexed
 
 			case Dir2::RightRight:
 			{
-				//Parent(Z) is wired with Y
-				if (auto P = Z->NSafeParent())
-				{
-					Y->parent += Z->parent;
-					((P->left == -(Z->parent)) ? P->left : P->right) += Z->right;
-				}
-				else
-				{
-					Y->parent = 0;
-				}
-
-				//Y becomes Z's parent
-				Z->parent = Z->right;
-
-				//T2 (former Left(Y)) is reconnected to Z on the right
-				if (Y->left)
-				{
-					Z->right = Z->right + Y->left;
-					Z->Nright()->parent = -(Z->right);
-				}
-				else
-					Z->right = 0;
-
-				//Left(Y) is repointed to Z
-				Y->left = -(Z->parent);
+				_Rotate_RR(Z, Y, X);
 
 				//X - not changed
 				if (!Y->tilt)
@@ -672,11 +1039,31 @@ namespace indexed
 			*/
 			if (Del->right)
 			{
-				n->right = _Off(n, Del) + Del->right;
+				n->right = (off)(_Off(n, Del) + Del->right);
 			}
 
 			Del->right = _Off(Del, n);
 		}
+
+		/* wipes out Count nodes, given by accessor At(index), and connects all of them on the right of DelChain node at once, in the given order */
+		template <typename Fa>
+		static void _DecommissionNodes(Fa& At, size_t Count, nptr Del)
+		{
+			ASSERT_THROW(Del, "DelChain node must be present for decommissioning");
+
+			nptr next = Del->right ? Del->Nright() : nullptr;
+
+			for (size_t i = Count; i--; )
+			{
+				nptr n = At(i);
+				memset(n, 0, sizeof(*n));
+
+				n->right = next ? _Off(n, next) : 0;
+				next = n;
+			}
+
+			Del->right = next ? _Off(Del, next) : 0;
+		}
 		static bool _EraseNode(nptr& outRoot, nptr n)
 		{
 			if (!n || n->IsEmpty())
@@ -711,6 +1098,9 @@ namespace indexed
 			//
 			if (P)
 			{
+				//subtree sizes are corrected first, so rotations made by retrace can rely on them
+				P->_CountUp(-1);
+
 				if (T1 && T2)
 				{
 					ASSERT_THROW(false, "Should not happen");
@@ -835,6 +1225,259 @@ namespace indexed
 
 			return n;
 		}
+
+		static nptr RightmostOf(nptr n)
+		{
+			while (n && n->right)
+			{
+				n = n->Nright();
+			}
+			return n;
+		}
+
+		/* returns previous 'in order' element or null if nowhere to go */
+		static nptr InorderPrevOf(nptr n)
+		{
+			if (!n)
+				return nullptr;
+
+			if (n->left)
+			{
+				n = RightmostOf(n->Nleft());
+			}
+			else
+			{
+				auto b = n->Branch();
+
+				while (nullptr != (n = n->NSafeParent()))
+				{
+					if (b == Dir::Right)
+						break;
+					else
+						b = n->Branch();
+				};
+			}
+
+			return n;
+		}
+
+		/* height of perfectly balanced subtree that carries Count nodes */
+		inline static constexpr u32 _BalancedHeight(u32 Count)
+		{
+			u32 h = 0;
+			for (; Count; Count >>= 1)
+				++h;
+			return h;
+		}
+
+		/*
+			Links Count nodes, given in sorted order by accessor At(index), into perfectly balanced subtree and
+			returns its root (or null for empty range). Parent of returned node is reset, the caller connects it.
+
+			Middle node becomes the root, extra node (if any) goes to the right branch, so tilt of any node
+			is either 'None' or 'Right'. Payloads are not touched.
+		*/
+		template <typename Fa>
+		static nptr _LinkSorted(Fa& At, u32 First, u32 Count)
+		{
+			if (!Count)
+				return nullptr;
+
+			u32 nl = (Count - 1) / 2, nr = Count - 1 - nl;
+
+			nptr L = _LinkSorted(At, First, nl);
+			nptr R = _LinkSorted(At, First + nl + 1, nr);
+
+			return _JoinSorted(At(First + nl), L, nl, R, nr);
+		}
+
+		/* makes n the root of balanced subtrees L and R of nl and nr nodes, as split by _LinkSorted, returns n */
+		static nptr _JoinSorted(nptr n, nptr L, u32 nl, nptr R, u32 nr)
+		{
+			n->parent = 0;
+
+			if (L)
+			{
+				n->left = _Off(n, L);
+				L->parent = -(n->left);
+			}
+			else
+				n->left = 0;
+
+			if (R)
+			{
+				n->right = _Off(n, R);
+				R->parent = -(n->right);
+			}
+			else
+				n->right = 0;
+
+			n->tilt = _BalancedHeight(nl) == _BalancedHeight(nr) ? Dir::None : Dir::Right;
+
+			if constexpr (Tt::counted)
+			{
+				n->count = nl + nr + 1;
+			}
+
+			return n;
+		}
+
+		/*
+			Join and split of detached subtrees (parent link of the root is zero), every subtree comes with its height,
+			which is zero for null.
+
+			_Join links L, node k and R, where all values of L are less than k and all values of R are greater,
+			into one tree, and returns its root and height. When heights differ by more than one, k is placed on the
+			inner spine of the higher tree at the level of the lower one, and the tree is retraced as after insertion,
+			so it takes O(difference of heights).
+		*/
+		static nptr _Join(nptr L, u32 hl, nptr k, nptr R, u32 hr, u32& h)
+		{
+			if (hl <= hr + 1 && hr <= hl + 1)
+			{
+				k->parent = 0;
+				k->left = L ? _Off(k, L) : 0;
+				k->right = R ? _Off(k, R) : 0;
+
+				if (L) L->parent = -(k->left);
+				if (R) R->parent = -(k->right);
+
+				k->tilt = hl == hr ? Dir::None : (hl > hr ? Dir::Left : Dir::Right);
+				k->_Recount();
+
+				h = std::max(hl, hr) + 1;
+				return k;
+			}
+
+			//walks down the inner spine of the higher tree, to the subtree c which is at most one level above the lower tree
+			bool right = hl > hr;
+			nptr top = right ? L : R, p = nullptr, c = top;
+			u32 hc = right ? hl : hr, lo = right ? hr : hl;
+
+			while (hc > lo + 1)
+			{
+				hc -= (c->tilt == (right ? Dir::Left : Dir::Right)) ? 2 : 1;
+				p = c;
+				c = right ? c->NSafeRight() : c->NSafeLeft();
+			}
+
+			int32_t cc = 0;
+			if constexpr (Tt::counted)
+			{
+				cc = (int32_t)CountOf(c);
+			}
+
+			//k takes the place of c, with c and the lower tree below it, and becomes one level higher than c was
+			u32 hk;
+			_Join(right ? c : L, right ? hc : lo, k, right ? R : c, right ? lo : hc, hk);
+
+			(right ? p->right : p->left) = _Off(p, k);
+			k->parent = -(right ? p->right : p->left);
+
+			if constexpr (Tt::counted)
+			{
+				p->_CountUp((int32_t)CountOf(k) - cc);
+			}
+
+			bool grew = Retrace_Insert(p, right ? Dir::Right : Dir::Left);
+
+			h = (right ? hl : hr) + (grew ? 1 : 0);
+			return top->Root();
+		}
+
+		/* removes the largest node from the tree and returns it, the rest and its height go to rest and hrest */
+		static nptr _SplitLast(nptr n, u32 h, nptr& rest, u32& hrest)
+		{
+			nptr a = n->NSafeLeft(), b = n->NSafeRight();
+			u32 ha = h - (n->tilt == Dir::Right ? 2 : 1), hb = h - (n->tilt == Dir::Left ? 2 : 1);
+
+			if (a) a->parent = 0;
+			if (b) b->parent = 0;
+
+			if (!b)
+			{
+				rest = a;
+				hrest = ha;
+				return n;
+			}
+
+			nptr br;
+			u32 hbr;
+			nptr last = _SplitLast(b, hb, br, hbr);
+
+			rest = _Join(a, ha, n, br, hbr, hrest);
+			return last;
+		}
+
+		/* joins L and R without a middle node, returns the root and the height */
+		static nptr _Join2(nptr L, u32 hl, nptr R, u32 hr, u32& h)
+		{
+			if (!L)
+			{
+				h = hr;
+				return R;
+			}
+
+			nptr rest;
+			u32 hrest;
+			nptr k = _SplitLast(L, hl, rest, hrest);
+
+			return _Join(rest, hrest, k, R, hr, h);
+		}
+
+		/*
+			Splits the tree under n of height h into trees of values that are less (L) and greater (R) than v,
+			returns the node equal to v (detached) or null. Takes O(h).
+		*/
+		template <typename Tk>
+		static nptr _Split(nptr n, u32 h, const Tk& v, const Tc& cmp, nptr& L, u32& hl, nptr& R, u32& hr)
+		{
+			if (!n)
+			{
+				L = R = nullptr;
+				hl = hr = 0;
+				return nullptr;
+			}
+
+			nptr a = n->NSafeLeft(), b = n->NSafeRight();
+			u32 ha = h - (n->tilt == Dir::Right ? 2 : 1), hb = h - (n->tilt == Dir::Left ? 2 : 1);
+
+			if (a) a->parent = 0;
+			if (b) b->parent = 0;
+
+			int c = _Compare3(cmp, v, n->payload);
+
+			if (!c)
+			{
+				L = a; hl = ha;
+				R = b; hr = hb;
+
+				n->parent = n->left = n->right = 0;
+				return n;
+			}
+
+			nptr m = nullptr;
+
+			if (c < 0)
+			{
+				nptr rl;
+				u32 hrl;
+				m = _Split(a, ha, v, cmp, L, hl, rl, hrl);
+
+				R = _Join(rl, hrl, n, b, hb, hr);
+			}
+			else
+			{
+				nptr lr;
+				u32 hlr;
+				m = _Split(b, hb, v, cmp, lr, hlr, R, hr);
+
+				L = _Join(a, ha, n, lr, hlr, hl);
+			}
+
+			return m;
+		}
+
 		/*
 			Finds the place for given value under this node
 
@@ -842,22 +1485,27 @@ namespace indexed
 			otherwise the pointer is for the last compared node and Dir tells on
 			which side of this node given value should be inserted.
 
+			Tk is either Tu or any key type, which is accepted by transparent comparator.
+			Every visited node costs one call of three-way comparator, or two calls of 'less'.
+
 		*/
-		template <typename Tc>
-		std::pair<nptr, Dir> _InsertionPointFor(const Tu& v)
+		template <typename Tk>
+		std::pair<nptr, Dir> _InsertionPointFor(const Tk& v, const Tc& cmp)
 		{
 			nptr n = this;
 
 			while (n)
 			{
-				if (Tc()(n->payload, v))
+				int c = _Compare3(cmp, v, n->payload);
+
+				if (c > 0)
 				{
 					if (n->right)
 						n = n->Nright();
 					else
 						return { n, Dir::Right };
 				}
-				else if (Tc()(v, n->payload))
+				else if (c < 0)
 				{
 					if (n->left)
 						n = n->Nleft();
@@ -887,6 +1535,9 @@ namespace indexed
 
 			iterator& operator++() { n_ = InorderNextOf(n_); return *this; }
 
+			//stepping back from the 'end' is not possible, since it does not know the tree
+			iterator& operator--() { n_ = InorderPrevOf(n_); return *this; }
+
 			const Tu& operator*() { return n_->payload; }
 
 
@@ -895,6 +1546,29 @@ namespace indexed
 			inline nptr node() const { return n_; }
 
 		};
+
+		/* walks the tree in descending order */
+		struct reverse_iterator
+		{
+			reverse_iterator(nptr n) { n_ = RightmostOf(n); }
+			reverse_iterator() {};
+
+			static reverse_iterator from_node(nptr n) { reverse_iterator it; it.n_ = n; return it; }
+
+			inline operator bool() const { return n_ ? true : false; }
+
+			inline bool operator!=(const reverse_iterator& o) { return n_ != o.n_; }
+
+			reverse_iterator& operator++() { n_ = InorderPrevOf(n_); return *this; }
+			reverse_iterator& operator--() { n_ = InorderNextOf(n_); return *this; }
+
+			const Tu& operator*() { return n_->payload; }
+
+
+			nptr n_ = { nullptr };
+
+			inline nptr node() const { return n_; }
+		};
 #pragma endregion
 
 	private:
@@ -1027,6 +1701,11 @@ namespace indexed
 
 			std::swap(tilt, o->tilt);
 
+			if constexpr (Tt::counted)
+			{
+				std::swap(this->count, o->count);
+			}
+
 		}
 
 		inline static void _Rotate_LL(nptr Z, nptr Y, nptr X)
@@ -1056,6 +1735,9 @@ namespace indexed
 
 			//Right(Y) is repointed to Z
 			Y->right = -(Z->parent);
+
+			Z->_Recount();
+			Y->_Recount();
 		}
 		inline static void _Rotate_RR(nptr Z, nptr Y, nptr X)
 		{
@@ -1085,6 +1767,8 @@ namespace indexed
 			//Left(Y) is repointed to Z
 			Y->left = -(Z->parent);
 
+			Z->_Recount();
+			Y->_Recount();
 		}
 		inline static void _Rotate_LR(nptr Z, nptr Y, nptr X)
 		{
@@ -1122,6 +1806,10 @@ namespace indexed
 			//X
 			X->right = _Off(X, Z);
 			X->left = _Off(X, Y);
+
+			Z->_Recount();
+			Y->_Recount();
+			X->_Recount();
 		}
 		inline static void _Rotate_RL(nptr Z, nptr Y, nptr X)
 		{
@@ -1159,6 +1847,10 @@ namespace indexed
 			//X
 			X->right = _Off(X, Y);
 			X->left = _Off(X, Z);
+
+			Z->_Recount();
+			Y->_Recount();
+			X->_Recount();
 		}
 	}; //Node
 
@@ -0,0 +1,391 @@
+#ifndef __base2_core_isharded__
+#define __base2_core_isharded__
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "./iavl.h"
+
+namespace indexed
+{
+
+	/*
+		Default partitioning of values among shards, by std::hash
+	*/
+	template <typename Tu>
+	struct hash_shard
+	{
+		inline size_t operator()(const Tu& v) const { return std::hash<Tu>()(v); }
+	};
+
+
+
+	/*
+		Set of N independent trees (shards), each one with its own lock, so that N threads can insert at once.
+
+		Value goes to shard Fp(v) % N: hash partitioning by default, a partitioner that gives ascending numbers
+		to ascending values makes shards hold consecutive ranges. Either way iteration is ordered, shards are merged
+		on the fly.
+
+		Global slot is (local slot * N + shard), so at(slot) is O(1) and zero is still 'no slot'; the slot type
+		limits every shard to 4G / N slots, insert and insert_batch throw std::length_error past that.
+
+		insert, insert_batch, erase and lookups lock the shards they touch. at(), iteration and size() do not:
+		they are meant to run between ingest phases, same as references into indexed::set are valid only until
+		the next change.
+	*/
+	template <typename Tu, uint32_t N, typename Tc = std::less<Tu>, typename Tt = default_traits, typename Fp = hash_shard<Tu>>
+	struct sharded_set
+	{
+		static_assert(N > 0);
+
+		using _Tree = _AvlTree<Tu, Tc, Tt>;
+		using _Iter = typename _Tree::_Iter;
+		using off = typename _Tree::off;
+
+		static constexpr slot Global(uint32_t shard, off o) { return o ? (slot)(size_t(o) / _Tree::Nsize() * N + shard) : 0; }
+		static constexpr uint32_t ShardOf(slot s) { return s % N; }
+		static constexpr off LocalOf(slot s) { return (off)(size_t(s / N) * _Tree::Nsize()); }
+
+		/* local offset of the shard has global slot, that is (local slot * N + shard) fits the slot type */
+		static constexpr bool HasGlobal(uint32_t shard, off o) { return size_t(o) / _Tree::Nsize() <= (size_t(std::numeric_limits<slot>::max()) - shard) / N; }
+
+
+		/*
+			Walks all shards in the order of values, keeps cursors of the shards in a heap with the smallest value on top
+		*/
+		struct iter
+		{
+			iter() {}
+			iter(sharded_set* s) : s_(s) {}
+
+			inline operator bool() const { return heap_.empty() ? false : true; }
+			inline bool operator!=(const iter& o) const
+			{
+				return heap_.empty() != o.heap_.empty() || (!heap_.empty() && heap_.front().first.node() != o.heap_.front().first.node());
+			}
+
+			iter& operator++()
+			{
+				std::pop_heap(heap_.begin(), heap_.end(), _Greater{ s_ });
+
+				if (++heap_.back().first)
+					std::push_heap(heap_.begin(), heap_.end(), _Greater{ s_ });
+				else
+					heap_.pop_back();
+
+				return *this;
+			}
+
+			const Tu& operator*() { return *heap_.front().first; }
+			const Tu* operator->() { return &*heap_.front().first; }
+
+			inline slot slot_of() { return Global(heap_.front().second, s_->_Shards[heap_.front().second]->tree.Optr(heap_.front().first.node())); }
+
+			/* adds the cursor of the shard, unless it is at the end */
+			void _Add(_Iter it, uint32_t shard)
+			{
+				if (it)
+				{
+					heap_.push_back({ it, shard });
+					std::push_heap(heap_.begin(), heap_.end(), _Greater{ s_ });
+				}
+			}
+
+		protected:
+
+			struct _Greater
+			{
+				sharded_set* s;
+
+				inline bool operator()(std::pair<_Iter, uint32_t>& a, std::pair<_Iter, uint32_t>& b) const
+				{
+					return s->_Cmp(*b.first, *a.first);
+				}
+			};
+
+			std::vector<std::pair<_Iter, uint32_t>>	heap_;
+			sharded_set*							s_ = { nullptr };
+		};
+
+
+		sharded_set(size_t initialCount = 0, const Tc& cmp = Tc(), const Fp& part = Fp()) : _Cmp(cmp), _Part(part)
+		{
+			for (auto& s : _Shards)
+			{
+				s.reset(new _Shard(cmp));
+			}
+
+			if (initialCount)
+				reserve(initialCount);
+		}
+
+		sharded_set(const sharded_set&) = delete;
+		sharded_set& operator=(const sharded_set&) = delete;
+
+
+		size_t size() const
+		{
+			size_t n = 0;
+			for (auto& s : _Shards)
+			{
+				n += s->tree.Size();
+			}
+			return n;
+		}
+
+		inline bool empty() const { return 0 == size() ? true : false; }
+
+		/* every shard gets room for its share of count elements */
+		void reserve(size_t count)
+		{
+			for (auto& s : _Shards)
+			{
+				std::lock_guard<std::mutex> g(s->lock);
+				s->tree.Reserve(count / N + count / N / 8 + 1);
+			}
+		}
+
+		std::pair<slot, bool> insert(const Tu& v)
+		{
+			uint32_t i = _ShardFor(v);
+			_Shard& s = *_Shards[i];
+
+			std::lock_guard<std::mutex> g(s.lock);
+
+			auto [o, added] = s.tree.Insert(v);
+
+			if (added && !HasGlobal(i, o))
+			{
+				s.tree.EraseAtOffset(o);
+				throw std::length_error("Global slot cannot address more values of the shard");
+			}
+
+			return { Global(i, o), added };
+		}
+
+		/*
+			Same as set::insert_batch: slot and 'inserted' flag for every value of random-access range [first, last)
+			in the input order. Values are split among shards, and shards are filled in parallel.
+
+			Values that would get no global slot are erased again and the call throws std::length_error,
+			once all shards are done; the rest of the batch stays inserted.
+		*/
+		template <typename It>
+		std::vector<std::pair<slot, bool>> insert_batch(It first, It last)
+		{
+			size_t count = (size_t)(last - first);
+			std::vector<std::pair<slot, bool>> res(count);
+
+			std::vector<Tu> parts[N];
+			std::vector<size_t> pos[N];
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				uint32_t s = _ShardFor(first[i]);
+
+				parts[s].push_back(first[i]);
+				pos[s].push_back(i);
+			}
+
+			_ForShards([&](uint32_t i)
+				{
+					if (parts[i].empty())
+						return;
+
+					_Shard& s = *_Shards[i];
+					std::lock_guard<std::mutex> g(s.lock);
+
+					std::vector<off> over;
+
+					s.tree.InsertBatch(parts[i].begin(), parts[i].size(), [&](size_t j, off o, bool added)
+						{
+							if (HasGlobal(i, o))
+							{
+								res[pos[i][j]] = { Global(i, o), added };
+							}
+							else if (added)
+							{
+								over.push_back(o);
+							}
+						});
+
+					for (off o : over)
+					{
+						s.tree.EraseAtOffset(o);
+					}
+
+					if (!over.empty())
+						throw std::length_error("Global slot cannot address more values of the shard");
+				});
+
+			return res;
+		}
+
+		template <typename Tk>
+		void erase(const Tk& k)
+		{
+			_Shard& s = *_Shards[_ShardFor(k)];
+
+			std::lock_guard<std::mutex> g(s.lock);
+			s.tree.Erase(k);
+		}
+
+		void erase_at(slot pos)
+		{
+			_Shard& s = *_Shards[ShardOf(pos)];
+
+			std::lock_guard<std::mutex> g(s.lock);
+			s.tree.EraseAtOffset(LocalOf(pos));
+		}
+
+		/* global slot of the value, or zero */
+		template <typename Tk>
+		slot find_slot(const Tk& k)
+		{
+			uint32_t i = _ShardFor(k);
+			_Shard& s = *_Shards[i];
+
+			std::lock_guard<std::mutex> g(s.lock);
+
+			auto it = s.tree.FindNode(k);
+			return it ? Global(i, s.tree.Optr(it.node())) : 0;
+		}
+
+		template <typename Tk>
+		bool contains(const Tk& k) { return find_slot(k) ? true : false; }
+
+		inline const Tu& at(slot pos) { return *_Shards[ShardOf(pos)]->tree.Tptr(LocalOf(pos)); }
+
+		iter begin()
+		{
+			iter it(this);
+			for (uint32_t i = 0; i < N; ++i)
+			{
+				it._Add(_Shards[i]->tree.Begin(), i);
+			}
+			return it;
+		}
+
+		iter end() { return iter(this); }
+
+		/* first value that is not less than k, across all shards */
+		template <typename Tk>
+		iter lower_bound(const Tk& k)
+		{
+			iter it(this);
+			for (uint32_t i = 0; i < N; ++i)
+			{
+				it._Add(_Iter::from_node(_Shards[i]->tree.LowerBoundNode(k)), i);
+			}
+			return it;
+		}
+
+		template <typename Fn>
+		void foreach(Fn&& f)
+		{
+			for (auto it = begin(); it; ++it)
+			{
+				f(*it);
+			}
+		}
+
+		void clear()
+		{
+			for (auto& s : _Shards)
+			{
+				std::lock_guard<std::mutex> g(s->lock);
+				s->tree.Clear();
+			}
+		}
+
+
+#ifdef CHECKED_BUILD
+		/* integrity of every shard, and every value sits in its own shard */
+		bool dbg_validate()
+		{
+			for (uint32_t i = 0; i < N; ++i)
+			{
+				if (!_Shards[i]->tree.__ValidateIntegrity())
+					return false;
+
+				for (auto it = _Shards[i]->tree.Begin(); it; ++it)
+				{
+					if (_ShardFor(*it) != i)
+						return false;
+				}
+			}
+
+			return true;
+		}
+#endif
+
+	protected:
+
+		struct alignas(64) _Shard
+		{
+			_Shard(const Tc& cmp) : tree(cmp) {}
+
+			_Tree		tree;
+			std::mutex	lock;
+		};
+
+		template <typename Tk>
+		inline uint32_t _ShardFor(const Tk& k) const { return (uint32_t)(_Part(k) % N); }
+
+		/* calls fn(shard) for every shard, shards are taken by up to one thread per core */
+		template <typename Fn>
+		void _ForShards(Fn&& fn)
+		{
+			uint32_t workers = std::min<uint32_t>(N, std::max(1u, std::thread::hardware_concurrency()));
+
+			std::atomic<uint32_t> next = { 0 };
+			std::exception_ptr err;
+			std::mutex errLock;
+
+			auto run = [&]()
+				{
+					for (uint32_t i; (i = next++) < N; )
+					{
+						try
+						{
+							fn(i);
+						}
+						catch (...)
+						{
+							std::lock_guard<std::mutex> g(errLock);
+							if (!err)
+								err = std::current_exception();
+						}
+					}
+				};
+
+			std::vector<std::thread> pool;
+			for (uint32_t w = 1; w < workers; ++w)
+			{
+				pool.emplace_back(run);
+			}
+
+			run();
+
+			for (auto& t : pool)
+			{
+				t.join();
+			}
+
+			if (err)
+				std::rethrow_exception(err);
+		}
+
+
+		std::unique_ptr<_Shard>	_Shards[N];
+
+		Tc		_Cmp;
+		Fp		_Part;
+	};
+
+}
+#endif
@@ -1,5 +1,10 @@
 #include <iostream>
 #include "core/iavl.h"
+#include "core/icompact.h"
+#include "core/ifrozen.h"
+#include "core/isharded.h"
+#include "core/iconcurrent.h"
+#include "core/ikeyed.h"
 
 
 
@@ -10,7 +15,10 @@
 #include <set>
 #include <vector>
 #include <chrono>
+#include <random>
+#include <numeric>
 #include <inttypes.h>
+#include <cstdio>
 
 using u32 = typename uint32_t;
 
@@ -27,10 +35,80 @@ struct uint2
 	inline bool operator!=(const uint2& o) const { return x != o.x; }
 };
 
+/*
+	Transparent comparator of uint2, values can be searched by x alone
+*/
+struct uint2_less
+{
+	using is_transparent = void;
+
+	inline bool operator()(const uint2& l, const uint2& r) const { return l.x < r.x; }
+	inline bool operator()(const uint2& l, u32 r) const { return l.x < r; }
+	inline bool operator()(u32 l, const uint2& r) const { return l < r.x; }
+};
+
+/*
+	Multi-field key, used to compare two-call 'less' descent with three-way descent
+*/
+struct uint3
+{
+	u32 a, b, c;
+};
+
+struct uint3_less
+{
+	inline bool operator()(const uint3& l, const uint3& r) const
+	{
+		return l.a != r.a ? l.a < r.a : (l.b != r.b ? l.b < r.b : l.c < r.c);
+	}
+};
+
+struct uint3_compare : uint3_less
+{
+	inline int compare(const uint3& l, const uint3& r) const
+	{
+		if (l.a != r.a) return l.a < r.a ? -1 : 1;
+		if (l.b != r.b) return l.b < r.b ? -1 : 1;
+		return l.c < r.c ? -1 : (l.c > r.c ? 1 : 0);
+	}
+};
+
+/*
+	Same set with node memory from anonymous mapping, which grows without copying
+*/
+struct mmap_traits : indexed::default_traits
+{
+	using backend = indexed::mmap_backend<>;
+};
+
+#ifdef INDEXED_COW
+/*
+	Node memory that snapshots share with the set
+*/
+struct cow_traits : indexed::default_traits
+{
+	using backend = indexed::cow_backend;
+};
+#endif
+
 //forwards
 
 
 void Scramble(std::vector<uint2>& list);
+void CompareBench(size_t LEN);
+void GrowthBench(size_t LEN);
+void CompactBench(size_t LEN);
+void FrozenBench(size_t LEN);
+void BatchLookupBench(size_t LEN);
+void SnapshotBench(size_t LEN);
+void ShardedBench(size_t LEN);
+void ParallelBuildBench(size_t LEN);
+void ParallelScanBench(size_t LEN);
+void SetAlgebraBench(size_t LEN);
+void BulkEraseBench(size_t LEN);
+void SlotScanBench(size_t LEN);
+void ConcurrentBench(size_t LEN);
+void KeyedBench(size_t LEN);
 
 
 int main()
@@ -85,7 +163,38 @@ int main()
 	std::cout << std::endl << "======================ISet for sorted insert===============================" << std::endl;
 	ISet.dbg_report();
 	std::cout << std::endl;
-		
+
+	//ISet, bulk construction from the same sorted array
+	{
+		indexed::set<uint2> BSet;
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		BSet.assign_sorted(Src.begin(), Src.end());
+		iSetMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << "Sorted bulk construction" << std::endl;
+		std::cout << " ISet:\t" << iSetMs << "(ms)" << ", size: " << BSet.size() << std::endl;
+		BSet.dbg_report();
+		std::cout << std::endl;
+	}
+
+	//ISet, append of the same sorted array
+	{
+		indexed::set<uint2> ASet;
+		ASet.reserve(Src.size());
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (const auto& v : Src)
+		{
+			ASet.append(v);
+		}
+		iSetMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << "ASC append" << std::endl;
+		std::cout << " ISet:\t" << iSetMs << "(ms)" << ", size: " << ASet.size() << std::endl;
+		std::cout << std::endl;
+	}
+
 
 	/*
 		Source array is resorted in DESC order, insert operations will not add any new elements
@@ -175,6 +284,1490 @@ int main()
 	{
 		std::cout << "Order of items is verified" << std::endl;
 	}
+
+	if (!ISet.dbg_validate())
+	{
+		std::cout << "ERROR: tree integrity is broken" << std::endl;
+	}
+	else
+	{
+		std::cout << "Tree integrity is verified" << std::endl;
+	}
+
+	//order statistics, every third value is missing, so ranks differ from values
+	{
+		indexed::set<uint2, std::less<uint2>, indexed::counted_traits> CSet;
+		std::vector<uint2> Sorted;
+
+		for (const auto& v : Set)
+		{
+			if (v.x % 3)
+			{
+				CSet.insert(v);
+				Sorted.push_back(v);
+			}
+		}
+
+		bool ok = CSet.dbg_validate() && CSet.size() == Sorted.size() && !CSet.nth(Sorted.size());
+
+		for (size_t k = 0; ok && k < Sorted.size(); k += 97)
+		{
+			ok = !(*CSet.nth(k) != Sorted[k]) && CSet.rank(Sorted[k]) == k;
+		}
+
+		for (u32 x = 0; ok && x + 1000 < LEN; x += 4099)
+		{
+			size_t lo = std::lower_bound(Sorted.begin(), Sorted.end(), uint2{ x, 0 }) - Sorted.begin();
+			size_t hi = std::lower_bound(Sorted.begin(), Sorted.end(), uint2{ x + 1000, 0 }) - Sorted.begin();
+
+			ok = CSet.rank({ x, 0 }) == lo && CSet.count_range({ x, 0 }, { x + 1000, 0 }) == hi - lo &&
+				CSet.count_range({ x + 1000, 0 }, { x, 0 }) == 0;
+		}
+
+		if (!ok)
+		{
+			std::cout << "ERROR: order statistics are not the same" << std::endl;
+		}
+		else
+		{
+			std::cout << "Order statistics are verified" << std::endl;
+		}
+	}
+
+	//bounds and reverse iteration, only even values are present, so probes fall on both values and gaps
+	{
+		std::set<uint2>		BSet;
+		indexed::set<uint2> IBSet;
+
+		for (const auto& v : Set)
+		{
+			if (0 == v.x % 2)
+			{
+				BSet.insert(v);
+				IBSet.insert(v);
+			}
+		}
+
+		auto same = [&](std::set<uint2>::iterator a, indexed::set<uint2>::iter b)
+		{
+			return a == BSet.end() ? !b : (b && !(*a != *b));
+		};
+
+		bool ok = !(IBSet.front() != *BSet.begin()) && !(IBSet.back() != *BSet.rbegin());
+
+		for (u32 x = 0; ok && x <= LEN; x += 7)
+		{
+			auto [lo, hi] = IBSet.equal_range({ x, 0 });
+
+			ok = same(BSet.lower_bound({ x, 0 }), IBSet.lower_bound({ x, 0 })) && same(BSet.upper_bound({ x, 0 }), IBSet.upper_bound({ x, 0 })) &&
+				same(BSet.lower_bound({ x, 0 }), lo) && same(BSet.upper_bound({ x, 0 }), hi);
+		}
+
+		auto r1 = BSet.rbegin();
+		size_t count = 0;
+
+		for (auto r2 = IBSet.rbegin(); ok && r2 != IBSet.rend(); ++r1, ++r2, ++count)
+		{
+			ok = r1 != BSet.rend() && !(*r1 != *r2);
+		}
+
+		if (!ok || count != BSet.size())
+		{
+			std::cout << "ERROR: bounds or reverse order of items are not the same" << std::endl;
+		}
+		else
+		{
+			std::cout << "Bounds and reverse order of items are verified" << std::endl;
+		}
+	}
+
+	//transparent lookup by x alone must give the same results as lookup by uint2, erase by x removes the same values
+	{
+		std::set<uint2, uint2_less>			TSet;
+		indexed::set<uint2, uint2_less>		ITSet;
+
+		for (const auto& v : Set)
+		{
+			if (v.x % 5)
+			{
+				TSet.insert(v);
+				ITSet.insert(v);
+			}
+		}
+
+		auto same = [&](std::set<uint2, uint2_less>::iterator a, indexed::set<uint2, uint2_less>::iter b)
+		{
+			return a == TSet.end() ? !b : (b && !(*a != *b));
+		};
+
+		bool ok = true;
+
+		for (u32 x = 0; ok && x <= LEN; x += 3)
+		{
+			auto [lo, hi] = ITSet.equal_range(x);
+
+			ok = ITSet.find_slot(x) == ITSet.find_slot(uint2{ x, 0 }) && same(TSet.find(x), ITSet.find(x)) &&
+				same(TSet.lower_bound(x), ITSet.lower_bound(x)) && same(TSet.upper_bound(x), ITSet.upper_bound(x)) &&
+				same(TSet.lower_bound(x), lo) && same(TSet.upper_bound(x), hi);
+		}
+
+		for (u32 x = 0; x < LEN; x += 2)
+		{
+			auto t = TSet.find(x);
+			if (t != TSet.end())
+			{
+				TSet.erase(t);
+			}
+
+			ITSet.erase(x);
+		}
+
+		ok = ok && ITSet.dbg_validate() && ITSet.size() == TSet.size();
+
+		auto a = TSet.begin();
+		for (auto b = ITSet.begin(); ok && b; ++a, ++b)
+		{
+			ok = !(*a != *b);
+		}
+
+		if (!ok)
+		{
+			std::cout << "ERROR: transparent lookup is not the same" << std::endl;
+		}
+		else
+		{
+			std::cout << "Transparent lookup is verified" << std::endl;
+		}
+	}
+
+	//layout change, with holes after erase: every value must be found at the slot, which remap reported for it
+	{
+		indexed::set<uint2> LSet(ISet);
+
+		for (u32 x = 0; x < LEN; x += 4)
+		{
+			LSet.erase({ x, 0 });
+		}
+
+		std::vector<indexed::slot> Before(LEN, 0);
+		for (u32 x = 0; x < LEN; ++x)
+		{
+			Before[x] = LSet.find_slot({ x, 0 });
+		}
+
+		auto Table = LSet.optimize_layout(indexed::Layout::VanEmdeBoas);
+
+		bool ok = LSet.dbg_validate();
+
+		for (u32 x = 0; ok && x < LEN; ++x)
+		{
+			indexed::slot s = Before[x] ? Table[Before[x]] : 0;
+			ok = LSet.find_slot({ x, 0 }) == s && (!s || LSet.at(s).x == x);
+		}
+
+		std::vector<indexed::slot> Moved(Table.size() + 1, 0);
+		size_t calls = 0;
+
+		LSet.optimize_layout(indexed::Layout::BreadthFirst, [&](indexed::slot from, indexed::slot to) { Moved[from] = to; ++calls; });
+
+		ok = ok && LSet.dbg_validate() && calls == LSet.size();
+
+		for (u32 x = 0; ok && x < LEN; ++x)
+		{
+			indexed::slot s = Before[x] ? Moved[Table[Before[x]]] : 0;
+			ok = LSet.find_slot({ x, 0 }) == s && (!s || LSet.at(s).x == x);
+		}
+
+		auto a = Set.begin();
+		for (auto b = LSet.begin(); ok && b; ++a, ++b)
+		{
+			if (0 == a->x % 4)
+			{
+				++a;
+			}
+
+			ok = !(*a != *b);
+		}
+
+		if (!ok)
+		{
+			std::cout << "ERROR: slots or order of items after layout change are not the same" << std::endl;
+		}
+		else
+		{
+			std::cout << "Slots and order of items after layout change are verified" << std::endl;
+		}
+	}
+
+	//persistence: mapped file must have the same values in the same slots, read-only mapping must refuse changes
+	{
+		const char* path = "indexed_set.bin";
+
+		indexed::set<uint2> RSet, WSet;
+		indexed::set<uint3, uint3_less> Other;
+
+		bool ok = ISet.save(path) && RSet.open_mapped(path) && WSet.open_mapped(path, indexed::MapMode::CopyOnWrite) &&
+			!Other.open_mapped(path) && !RSet.open_mapped("missing/indexed_set.bin");
+
+		ok = ok && RSet.dbg_validate() && RSet.size() == ISet.size();
+
+		for (u32 x = 0; ok && x < LEN; ++x)
+		{
+			ok = RSet.find_slot({ x, 0 }) == ISet.find_slot({ x, 0 });
+		}
+
+		auto a = Set.begin();
+		for (auto b = RSet.begin(); ok && b; ++a, ++b)
+		{
+			ok = !(*a != *b);
+		}
+
+		bool refused = false;
+		try
+		{
+			RSet.insert({ u32(LEN), 0 });
+		}
+		catch (...)
+		{
+			refused = true;
+		}
+
+		//private changes of copy-on-write mapping are not seen in the file
+		WSet.insert({ u32(LEN), 0 });
+		WSet.erase({ 0, 0 });
+
+		indexed::set<uint2> CSet;
+
+		ok = ok && refused && WSet.dbg_validate() && WSet.size() == ISet.size() && WSet.find_slot({ u32(LEN), 0 }) && !WSet.find_slot({ 0, 0 }) &&
+			CSet.open_mapped(path) && CSet.size() == ISet.size() && !CSet.find_slot({ u32(LEN), 0 }) && CSet.find_slot({ 0, 0 });
+
+		RSet.clear();
+		WSet.clear();
+		CSet.clear();
+		std::remove(path);
+
+		if (!ok)
+		{
+			std::cout << "ERROR: mapped file is not the same as saved set" << std::endl;
+		}
+		else
+		{
+			std::cout << "Mapped file is verified" << std::endl;
+		}
+	}
+
+	//reservation past the offset type must throw instead of truncating, the set must stay usable,
+	//and a batch of present values must not be refused for its worst case
+	{
+		indexed::set<u32, std::less<u32>, indexed::small_traits> SSet;
+
+		bool refused = false;
+		try
+		{
+			SSet.reserve(size_t(1) << 20);
+		}
+		catch (const std::length_error&)
+		{
+			refused = true;
+		}
+
+		std::vector<u32> Vals(1500);
+		std::iota(Vals.begin(), Vals.end(), 0);
+
+		SSet.reserve(Vals.size());
+
+		for (auto x : Vals)
+		{
+			SSet.insert(x);
+		}
+
+		bool batched = true;
+		try
+		{
+			SSet.insert_batch(Vals.begin(), Vals.end());
+		}
+		catch (const std::length_error&)
+		{
+			batched = false;
+		}
+
+		if (!refused || !batched || !SSet.dbg_validate() || SSet.size() != Vals.size())
+		{
+			std::cout << "ERROR: reservation past the offset type is not refused" << std::endl;
+		}
+		else
+		{
+			std::cout << "Reservation limit is verified" << std::endl;
+		}
+	}
+
+	CompareBench(LEN);
+	GrowthBench(16 * LEN);
+	CompactBench(4 * LEN);
+	FrozenBench(4 * LEN);
+	BatchLookupBench(4 * LEN);
+	SnapshotBench(16 * LEN);
+	ShardedBench(16 * LEN);
+	ParallelBuildBench(16 * LEN);
+	ParallelScanBench(16 * LEN);
+	SetAlgebraBench(16 * LEN);
+	BulkEraseBench(16 * LEN);
+	SlotScanBench(16 * LEN);
+	ConcurrentBench(LEN / 4);
+	KeyedBench(4 * LEN);
+}
+
+
+/*
+	128-byte record, ordered by its key
+*/
+struct record
+{
+	u32 key;
+	u32 data[31];
+
+	inline bool operator<(const record& o) const { return key < o.key; }
+};
+
+struct record_key
+{
+	inline u32 operator()(const record& r) const { return r.key; }
+};
+
+/*
+	Large records, kept in tree nodes (set) and apart from compact key nodes (keyed_set), then the order and
+	the records of keyed_set are checked, also after optimize_layout
+*/
+void KeyedBench(size_t LEN)
+{
+	std::vector<u32> Keys(LEN);
+	std::mt19937 gen(47);
+	for (auto& k : Keys)
+	{
+		k = gen();
+	}
+
+	std::vector<u32> Probes(Keys);
+	std::shuffle(Probes.begin(), Probes.end(), gen);
+
+	//probe is the key for keyed_set, and the record with the key for set
+	auto Run = [&](const char* name, auto& S, auto&& probe)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (auto k : Keys)
+		{
+			S.insert(record{ k, { k } });
+		}
+		float insMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		size_t sum = 0;
+
+		t0 = std::chrono::high_resolution_clock::now();
+		for (auto k : Probes)
+		{
+			sum += S.find_slot(probe(k));
+		}
+		float findMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << name << "insert: " << insMs << "(ms)" << ", find: " << findMs << "(ms)" << ", slot sum: " << sum << std::endl;
+	};
+
+	std::cout << std::endl << "Records of " << sizeof(record) << " bytes, in nodes vs apart from keys" << std::endl;
+
+	{
+		indexed::set<record> S;
+		Run("        set:\t", S, [](u32 k) { return record{ k }; });
+	}
+
+	indexed::keyed_set<u32, record, record_key> K;
+	Run("  keyed_set:\t", K, [](u32 k) { return k; });
+
+	std::set<u32> Ref(Keys.begin(), Keys.end());
+
+	auto Verify = [&]()
+	{
+		if (!K.dbg_validate() || K.size() != Ref.size())
+			return false;
+
+		auto r = Ref.begin();
+		for (auto it = K.begin(); it; ++it, ++r)
+		{
+			if (it.key() != *r || it->key != *r || it->data[0] != *r || K.at(it.slot_of()).key != *r)
+				return false;
+		}
+
+		return true;
+	};
+
+	bool ok = Verify();
+
+	//every key and its record move from the old slot to the new one
+	std::vector<u32> before(K.size() + 1);
+	for (auto it = K.begin(); it; ++it)
+	{
+		before[it.slot_of()] = it.key();
+	}
+
+	std::vector<std::pair<indexed::slot, indexed::slot>> moved;
+	K.optimize_layout(indexed::Layout::VanEmdeBoas, [&](indexed::slot from, indexed::slot to) { moved.push_back({ from, to }); });
+
+	ok = ok && moved.size() == Ref.size() && Verify();
+
+	for (auto& m : moved)
+	{
+		ok = ok && K.key_at(m.second) == before[m.first] && K.at(m.second).key == before[m.first];
+	}
+
+	std::cout << (ok ? "Keyed records are verified" : "ERROR: keyed records are not the same") << std::endl;
+}
+
+
+/*
+	One writer inserts even values in random order, then erases some of them, while readers look them up.
+	Every reader checks that values published before its lookup are found in their slots, and odd values never are.
+	publish(s) makes the writes so far visible to readers, it is called after every 'batch' writes.
+*/
+template <typename Ts, typename Fp>
+void ConcurrentRun(const char* name, const std::vector<u32>& Src, size_t batch, Fp&& publish)
+{
+	size_t LEN = Src.size();
+
+	Ts S;
+
+	//values Src[0 .. done) are published, values Src[0 .. gone) are erased since
+	std::atomic<size_t> done = { 0 }, gone = { 0 };
+	std::atomic<bool> stop = { false };
+	std::atomic<size_t> lookups = { 0 }, errors = { 0 };
+
+	auto Read = [&](uint32_t id)
+	{
+		typename Ts::reader r(S);
+		std::mt19937 gen(id);
+
+		size_t n = 0, bad = 0;
+		while (!stop.load(std::memory_order_acquire))
+		{
+			size_t g = gone.load(std::memory_order_acquire), d = done.load(std::memory_order_acquire);
+			if (d <= g)
+				continue;
+
+			size_t j = g + gen() % (d - g);
+			u32 v = Src[j], found = 0;
+
+			indexed::slot s = r.find_slot(v);
+			bool ok = s && r.at(s, found) && found == v;
+
+			//writer announces erasure before it starts, so a value that is not announced must have been there
+			if (!ok && gone.load(std::memory_order_acquire) <= j)
+				++bad;
+
+			if (r.contains(v + 1))
+				++bad;
+
+			++n;
+		}
+
+		lookups += n;
+		errors += bad;
+	};
+
+	uint32_t readers = std::max(2u, std::thread::hardware_concurrency() - 1);
+
+	std::vector<std::thread> pool;
+	for (uint32_t i = 0; i < readers; ++i)
+	{
+		pool.emplace_back(Read, i + 1);
+	}
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		S.insert(Src[i]);
+
+		if ((i + 1) % batch == 0 || i + 1 == LEN)
+		{
+			publish(S);
+			done.store(i + 1, std::memory_order_release);
+		}
+	}
+
+	for (size_t i = 0; i < LEN / 2; ++i)
+	{
+		gone.store(i + 1, std::memory_order_release);
+		S.erase(Src[i]);
+
+		if ((i + 1) % batch == 0 || i + 1 == LEN / 2)
+		{
+			publish(S);
+		}
+	}
+
+	float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+	stop = true;
+	for (auto& t : pool)
+	{
+		t.join();
+	}
+
+	std::cout << name << ms << "(ms)" << ", size: " << S.size() << ", lookups: " << lookups << std::endl;
+
+	if (errors || !S.dbg_validate())
+	{
+		std::cout << "ERROR: " << errors << " lookups saw wrong state" << std::endl;
+	}
+	else
+	{
+		std::cout << "Concurrent lookups are verified" << std::endl;
+	}
+}
+
+void ConcurrentBench(size_t LEN)
+{
+	std::vector<u32> Src(LEN);
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		Src[i] = (u32)(2 * i);
+	}
+	std::shuffle(Src.begin(), Src.end(), std::mt19937(43));
+
+	std::cout << std::endl << "One writer, " << std::max(2u, std::thread::hardware_concurrency() - 1) << " readers" << std::endl;
+
+	ConcurrentRun<indexed::concurrent_set<u32>>("  epochs, publish every 256:\t", Src, 256, [](auto& s) { s.publish(); });
+	ConcurrentRun<indexed::mirrored_set<u32>>("   mirrored, every write:\t", Src, 1, [](auto&) {});
+}
+
+
+/*
+	Sum over all values of randomly filled set with holes: in value order and in slot order
+*/
+void SlotScanBench(size_t LEN)
+{
+	indexed::set<u32> S;
+	std::mt19937 gen(25);
+
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		S.insert(gen());
+	}
+
+	S.erase_if([](u32 v) { return v % 10 < 3; });
+
+	auto Run = [&](const char* name, auto&& fn)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		uint64_t sum = fn();
+		float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << name << ms << "(ms)" << ", sum: " << sum << std::endl;
+	};
+
+	std::cout << std::endl << "Scan of " << S.size() << " values, 30% of slots deleted" << std::endl;
+
+	Run("       foreach:\t", [&]() { uint64_t sum = 0; S.foreach([&](u32 v) { sum += v; }); return sum; });
+	Run(" for_each_slot:\t", [&]() { uint64_t sum = 0; S.for_each_slot([&](u32 v, indexed::slot) { sum += v; }); return sum; });
+	Run("     slot_iter:\t", [&]() { uint64_t sum = 0; for (auto it = S.slot_begin(); it != S.slot_end(); ++it) sum += *it; return sum; });
+}
+
+
+/*
+	erase_range and erase_if on a set of even values in random order against std::set: bounds that are present
+	and absent, empty and reversed ranges, the whole set, and both ways of erase_if (one by one and relinking).
+	Survivors must keep their slots.
+*/
+template <typename Tt>
+bool BulkEraseVerify(size_t LEN)
+{
+	using Ts = indexed::set<u32, std::less<u32>, Tt>;
+
+	std::vector<u32> Src(LEN);
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		Src[i] = (u32)(2 * i + 2);
+	}
+	std::shuffle(Src.begin(), Src.end(), std::mt19937(31));
+
+	Ts A;
+	std::set<u32> R;
+	for (auto v : Src)
+	{
+		A.insert(v);
+		R.insert(v);
+	}
+
+	bool ok = true;
+
+	auto Check = [&](Ts& S, std::set<u32>& E, size_t erased, size_t expected)
+	{
+		ok = ok && erased == expected && S.dbg_validate() && S.size() == E.size();
+
+		if (ok && !E.empty())
+		{
+			ok = S.front() == *E.begin() && S.back() == *E.rbegin();
+		}
+
+		auto e = E.begin();
+		S.foreach([&](u32 v) { ok = ok && e != E.end() && *e++ == v; });
+
+		for (auto v : E)
+		{
+			ok = ok && S.find_slot(v) == A.find_slot(v);
+		}
+	};
+
+	u32 top = (u32)(2 * LEN + 2);
+
+	//present and absent bounds, empty, reversed, the whole set and beyond it
+	std::pair<u32, u32> ranges[] = {
+		{ 100, 300 }, { 101, 301 }, { 100, 301 }, { 101, 300 },
+		{ 100, 100 }, { 101, 102 }, { 300, 100 },
+		{ 2, top }, { 0, top + 10 }, { 0, 2 }, { top, top + 10 }, { 2, 4 }, { top - 2, top } };
+
+	for (auto [lo, hi] : ranges)
+	{
+		Ts S(A);
+		std::set<u32> E(R);
+
+		size_t expected = 0;
+		if (lo < hi)
+		{
+			auto a = E.lower_bound(lo), b = E.lower_bound(hi);
+			expected = (size_t)std::distance(a, b);
+			E.erase(a, b);
+		}
+
+		size_t erased = S.erase_range(lo, hi);
+		Check(S, E, erased, expected);
+	}
+
+	//a few victims are erased one by one, many make the survivors relinked, none and all are edge cases
+	for (u32 m : { 2000u, 3u, 1u, 0u })
+	{
+		auto pred = [m](u32 v) { return m == 0 ? false : (v / 2) % m == 0; };
+
+		Ts S(A);
+		std::set<u32> E(R);
+
+		size_t expected = 0;
+		for (auto it = E.begin(); it != E.end(); )
+		{
+			if (pred(*it))
+			{
+				it = E.erase(it);
+				++expected;
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		size_t erased = S.erase_if(pred);
+		Check(S, E, erased, expected);
+	}
+
+	return ok;
+}
+
+
+/*
+	Eviction of the oldest quarter of values and of every third value: one by one, and by erase_range / erase_if
+*/
+void BulkEraseBench(size_t LEN)
+{
+	std::vector<u32> Src(LEN);
+	std::iota(Src.begin(), Src.end(), 0u);
+
+	indexed::set<u32> A;
+	A.assign_sorted(Src.begin(), Src.end());
+
+	auto Run = [&](const char* name, auto&& fn)
+	{
+		indexed::set<u32> S(A);
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		fn(S);
+		float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << name << ms << "(ms)" << ", size: " << S.size() << std::endl;
+	};
+
+	u32 window = (u32)(LEN / 4);
+
+	std::cout << std::endl << "Bulk erase from " << A.size() << " values" << std::endl;
+
+	Run("    erase window:\t", [&](indexed::set<u32>& S) { for (u32 v = 0; v < window; ++v) S.erase(v); });
+	Run("     erase_range:\t", [&](indexed::set<u32>& S) { S.erase_range(0u, window); });
+	Run(" erase every 3rd:\t", [&](indexed::set<u32>& S) { for (u32 v = 0; v < (u32)LEN; v += 3) S.erase(v); });
+	Run("        erase_if:\t", [&](indexed::set<u32>& S) { S.erase_if([](u32 v) { return v % 3 == 0; }); });
+
+	if (!BulkEraseVerify<indexed::default_traits>(LEN / 8) || !BulkEraseVerify<indexed::counted_traits>(LEN / 8))
+	{
+		std::cout << "ERROR: bulk erase is not the same as std::set" << std::endl;
+	}
+	else
+	{
+		std::cout << "Bulk erase is verified" << std::endl;
+	}
+}
+
+
+/*
+	unite, intersect and subtract of random sets (one of them empty, small or of the same size) against std::set_*
+	on sorted vectors, sequential and parallel, in place and by free functions: values, integrity, and slots of
+	values from the left set, which must stay where they were
+*/
+template <typename Tt>
+bool SetAlgebraVerify(size_t LEN)
+{
+	using Ts = indexed::set<u32, std::less<u32>, Tt>;
+
+	std::mt19937 gen(29);
+
+	Ts A;
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		A.insert(gen() % (3 * LEN));
+	}
+	A.erase_if([](u32 v) { return v % 7 == 0; });
+
+	std::vector<u32> VA;
+	A.foreach([&](u32 v) { VA.push_back(v); });
+
+	bool ok = true;
+
+	for (size_t m : { size_t(0), LEN / 64, LEN })
+	{
+		Ts B;
+		for (size_t i = 0; i < m; ++i)
+		{
+			B.insert(gen() % (3 * LEN));
+		}
+
+		std::vector<u32> VB;
+		B.foreach([&](u32 v) { VB.push_back(v); });
+
+		for (uint32_t threads : { 1u, 4u })
+		{
+			auto Check = [&](Ts& S, int op)
+			{
+				std::vector<u32> want, got;
+
+				if (op == 0) std::set_union(VA.begin(), VA.end(), VB.begin(), VB.end(), std::back_inserter(want));
+				if (op == 1) std::set_intersection(VA.begin(), VA.end(), VB.begin(), VB.end(), std::back_inserter(want));
+				if (op == 2) std::set_difference(VA.begin(), VA.end(), VB.begin(), VB.end(), std::back_inserter(want));
+
+				S.foreach([&](u32 v) { got.push_back(v); });
+
+				ok = ok && S.dbg_validate() && S.size() == want.size() && got == want;
+
+				for (size_t i = 0; ok && i < VA.size(); i += 3)
+				{
+					indexed::slot s = S.find_slot(VA[i]);
+					ok = !s || s == A.find_slot(VA[i]);
+				}
+			};
+
+			Ts U(A), I(A), D(A);
+
+			U.unite(B, threads);
+			I.intersect(B, threads);
+			D.subtract(B, threads);
+
+			Check(U, 0);
+			Check(I, 1);
+			Check(D, 2);
+
+			Ts FU = indexed::set_union(A, B, threads);
+			Ts FI = indexed::set_intersection(A, B, threads);
+			Ts FD = indexed::set_difference(A, B, threads);
+
+			Check(FU, 0);
+			Check(FI, 1);
+			Check(FD, 2);
+
+			//arguments stay as they are
+			ok = ok && A.size() == VA.size() && B.size() == VB.size();
+		}
+	}
+
+	return ok;
+}
+
+
+/*
+	Union and difference of a large set and a smaller one: value by value, and by split and join
+*/
+void SetAlgebraBench(size_t LEN)
+{
+	std::mt19937 gen(23);
+
+	indexed::set<u32> A;
+	std::vector<u32> Src(LEN);
+	for (auto& v : Src)
+	{
+		v = gen();
+	}
+	A.assign_parallel(Src.begin(), Src.end());
+
+	std::cout << std::endl << "Set algebra, " << A.size() << " values, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+	for (size_t m : { LEN / 64, LEN })
+	{
+		indexed::set<u32> B;
+		for (size_t i = 0; i < m; ++i)
+		{
+			B.insert(i % 2 ? Src[gen() % LEN] : gen());
+		}
+
+		auto Run = [&](const char* name, auto&& fn)
+		{
+			indexed::set<u32> S(A);
+
+			auto t0 = std::chrono::high_resolution_clock::now();
+			fn(S);
+			float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+			std::cout << name << ms << "(ms)" << ", size: " << S.size() << std::endl;
+		};
+
+		std::cout << " with " << B.size() << " values" << std::endl;
+
+		Run("   insert:\t", [&](indexed::set<u32>& S) { B.foreach([&](u32 v) { S.insert(v); }); });
+		Run("    unite:\t", [&](indexed::set<u32>& S) { S.unite(B); });
+		Run(" unite x4:\t", [&](indexed::set<u32>& S) { S.unite(B, 4); });
+		Run("    erase:\t", [&](indexed::set<u32>& S) { B.foreach([&](u32 v) { S.erase(v); }); });
+		Run(" subtract:\t", [&](indexed::set<u32>& S) { S.subtract(B); });
+	}
+
+	if (!SetAlgebraVerify<indexed::default_traits>(LEN / 8) || !SetAlgebraVerify<indexed::counted_traits>(LEN / 8))
+	{
+		std::cout << "ERROR: set algebra is not the same as std::set_*" << std::endl;
+	}
+	else
+	{
+		std::cout << "Set algebra is verified" << std::endl;
+	}
+}
+
+
+/*
+	Sum over all values: sequential in-order walk against parallel reduction over split ranges
+*/
+void ParallelScanBench(size_t LEN)
+{
+	indexed::set<u32> S;
+
+	std::vector<u32> Src(LEN);
+	std::iota(Src.begin(), Src.end(), 0u);
+	S.assign_parallel(Src.begin(), Src.end());
+
+	auto Run = [&](const char* name, auto&& fn)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		uint64_t sum = fn();
+		float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << name << ms << "(ms)" << ", sum: " << sum << std::endl;
+	};
+
+	std::cout << std::endl << "Scan, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+	Run("   foreach:\t", [&]() { uint64_t sum = 0; S.foreach([&](u32 v) { sum += v; }); return sum; });
+	Run("  parallel:\t", [&]() { return S.parallel_reduce(uint64_t(0), [](uint64_t& r, u32 v) { r += v; }, std::plus<uint64_t>()); });
+}
+
+
+/*
+	Parallel build must give the same set as insertion one by one: values with equal x are told apart by y,
+	which is the index in the input, so the first of equal values must be the one that stays. The input is
+	larger than two parallel chunks (PARALLEL_MIN), so the chunks are sorted and merged by several threads.
+*/
+template <typename Tt>
+bool ParallelBuildVerify(size_t LEN)
+{
+	using Ts = indexed::set<uint2, std::less<uint2>, Tt>;
+
+	std::vector<uint2> Src(LEN);
+	std::mt19937 gen(43);
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		Src[i] = { (u32)(gen() % (LEN / 2)), (u32)i };
+	}
+
+	Ts One;
+	for (const auto& v : Src)
+	{
+		One.insert(v);
+	}
+
+	std::vector<uint2> Want;
+	One.foreach([&](const uint2& v) { Want.push_back(v); });
+
+	bool ok = true;
+
+	for (uint32_t threads : { 2u, 3u, 4u, 8u })
+	{
+		Ts P;
+		P.assign_parallel(Src.begin(), Src.end(), threads);
+
+		ok = ok && P.dbg_validate() && P.size() == Want.size();
+
+		size_t k = 0;
+		P.foreach([&](const uint2& v)
+			{
+				ok = ok && k < Want.size() && v.x == Want[k].x && v.y == Want[k].y && P.find_slot(v) == (indexed::slot)(k + 1);
+				++k;
+			});
+	}
+
+	return ok;
+}
+
+
+/*
+	Build from unsorted input with duplicates: value by value, and sorted and linked in parallel
+*/
+void ParallelBuildBench(size_t LEN)
+{
+	std::vector<u32> Src(LEN);
+	std::mt19937 gen(41);
+	for (auto& v : Src)
+	{
+		v = gen() % (u32)(LEN * 3 / 4);
+	}
+
+	auto Run = [&](const char* name, auto&& fn)
+	{
+		indexed::set<u32> S;
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		fn(S);
+		float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << name << ms << "(ms)" << ", size: " << S.size() << std::endl;
+	};
+
+	std::cout << std::endl << "Bulk build, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+	Run("     insert:\t", [&](indexed::set<u32>& S) { for (auto v : Src) S.insert(v); });
+	Run("   parallel:\t", [&](indexed::set<u32>& S) { S.assign_parallel(Src.begin(), Src.end()); });
+
+	bool ok = ParallelBuildVerify<indexed::default_traits>(8 * 64 * 1024 + 1234) &&
+		ParallelBuildVerify<indexed::counted_traits>(2 * 64 * 1024 + 1234);
+
+	std::cout << (ok ? "Parallel build is verified" : "ERROR: parallel build is not the same as insertion") << std::endl;
+}
+
+
+/*
+	Ingest of random values in batches into one set and into 16 shards, which take the batch in parallel
+*/
+void ShardedBench(size_t LEN)
+{
+	std::vector<u32> Src(LEN);
+	std::mt19937 gen(37);
+	for (auto& v : Src)
+	{
+		v = gen();
+	}
+
+	const size_t BATCH = 64 * 1024;
+
+	auto Run = [&](const char* name, auto&& S)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+
+		for (size_t i = 0; i < LEN; i += BATCH)
+		{
+			S.insert_batch(Src.begin() + i, Src.begin() + std::min(LEN, i + BATCH));
+		}
+
+		float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		std::cout << name << ms << "(ms)" << ", size: " << S.size() << std::endl;
+	};
+
+	std::cout << std::endl << "Sharded ingest, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+
+	Run("     set:\t", indexed::set<u32>());
+	Run(" sharded:\t", indexed::sharded_set<u32, 16>());
+
+	//64K shards leave 64K local slots to each shard, values past that must be refused, not get a wrapped slot
+	{
+		struct first_shard
+		{
+			inline size_t operator()(u32) const { return 0; }
+		};
+
+		using Ts = indexed::sharded_set<u32, 64 * 1024, std::less<u32>, indexed::default_traits, first_shard>;
+
+		std::unique_ptr<Ts> S(new Ts());
+
+		bool ok = true;
+		u32 x = 0;
+		try
+		{
+			for (; x < 64 * 1024; ++x)
+			{
+				auto [s, added] = S->insert(x);
+				ok = ok && added && S->at(s) == x;
+			}
+		}
+		catch (const std::length_error&)
+		{
+		}
+
+		bool refused = false;
+		std::vector<u32> batch = { 0, x, x + 1 };
+		try
+		{
+			S->insert_batch(batch.begin(), batch.end());
+		}
+		catch (const std::length_error&)
+		{
+			refused = true;
+		}
+
+		ok = ok && x == 64 * 1024 - 1 && refused && S->size() == x && !S->contains(x) && !S->contains(x + 1) && S->dbg_validate();
+
+		std::cout << (ok ? "Sharded slot limit is verified" : "ERROR: sharded slot limit is not enforced") << std::endl;
+	}
+}
+
+
+/*
+	Every snapshot must hold what the set held when it was taken, in the same slots, and keep it while the set
+	goes on: inserts that grow the buffer, erasures, and further snapshots, which with cow_backend move the set
+	into a new memory file once it has changed enough. Snapshots refuse changes, their copies do not.
+*/
+template <typename Ts>
+bool SnapshotVerify(size_t LEN)
+{
+	std::vector<u32> Src(LEN);
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		Src[i] = (u32)(2 * i);
+	}
+	std::shuffle(Src.begin(), Src.end(), std::mt19937(37));
+
+	Ts S;
+	for (auto v : Src)
+	{
+		S.insert(v);
+	}
+
+	struct taken
+	{
+		std::vector<u32> values;
+		std::vector<indexed::slot> slots;
+	};
+
+	//sets are not moved by the vector, which would copy them
+	std::vector<Ts> snaps;
+	std::vector<taken> was;
+	snaps.reserve(6);
+
+	bool ok = true;
+
+	for (u32 r = 0; r < 6; ++r)
+	{
+		snaps.push_back(S.snapshot());
+
+		taken t;
+		S.foreach([&](u32 v) { t.values.push_back(v); t.slots.push_back(S.find_slot(v)); });
+		was.push_back(t);
+
+		//odd values grow the buffer, every other round erases a part of even ones as well
+		for (size_t i = r * LEN / 6; i < (r + 1) * LEN / 6; ++i)
+		{
+			S.insert(Src[i] + 1);
+
+			if (r % 2)
+			{
+				S.erase(Src[(i + LEN / 2) % LEN]);
+			}
+		}
+	}
+
+	for (size_t k = 0; k < snaps.size(); ++k)
+	{
+		Ts& snap = snaps[k];
+
+		ok = ok && snap.dbg_validate() && snap.size() == was[k].values.size();
+
+		size_t i = 0;
+		snap.foreach([&](u32 v) { ok = ok && i < was[k].values.size() && was[k].values[i] == v && snap.find_slot(v) == was[k].slots[i]; ++i; });
+
+		bool refused = false;
+		try
+		{
+			snap.insert((u32)(2 * LEN + 1));
+		}
+		catch (...)
+		{
+			refused = true;
+		}
+
+		Ts copy(snap);
+		ok = ok && refused && copy.insert((u32)(2 * LEN + 1)).second && copy.dbg_validate();
+	}
+
+	return ok;
+}
+
+
+/*
+	Point-in-time copies of a large set, taken between small batches of changes: a full copy of the buffer
+	every time against a snapshot that shares pages with the set
+*/
+void SnapshotBench(size_t LEN)
+{
+#ifdef INDEXED_COW
+	std::cout << std::endl << "Snapshots" << std::endl;
+
+	auto Run = [&](const char* name, auto&& S, auto&& take)
+	{
+		for (u32 i = 0; i < (u32)LEN; ++i)
+		{
+			S.insert(i * 2);
+		}
+
+		std::mt19937 gen(31);
+		size_t found = 0;
+		float ms = 0;
+
+		for (int r = 0; r < 16; ++r)
+		{
+			for (int i = 0; i < 1000; ++i)
+			{
+				S.insert(gen() % (u32)(2 * LEN));
+			}
+
+			auto t0 = std::chrono::high_resolution_clock::now();
+			auto snap = take(S);
+
+			//the first read keeps the copy inside the measured interval
+			found += snap.find_slot(gen() % (u32)(2 * LEN)) ? 1 : 0;
+			ms += (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+		}
+
+		std::cout << name << ms << "(ms)" << ", probes found: " << found << std::endl;
+	};
+
+	Run("     copy:\t", indexed::set<u32>(), [](auto& S) { return indexed::set<u32>(S); });
+	Run(" snapshot:\t", indexed::set<u32, std::less<u32>, cow_traits>(), [](auto& S) { return S.snapshot(); });
+#endif
+
+	bool ok = SnapshotVerify<indexed::set<u32>>(LEN / 4);
+#ifdef INDEXED_COW
+	ok = ok && SnapshotVerify<indexed::set<u32, std::less<u32>, cow_traits>>(LEN / 4);
+#endif
+
+	std::cout << (ok ? "Snapshots are verified" : "ERROR: snapshots changed after they were taken") << std::endl;
+}
+
+
+/*
+	Lookup of random probes one by one and in interleaved batches, and of sorted probes one by one and
+	with descents continued from the previous one
+*/
+void BatchLookupBench(size_t LEN)
+{
+	std::vector<u32> Keys(LEN);
+	std::iota(Keys.begin(), Keys.end(), 1u);
+	std::shuffle(Keys.begin(), Keys.end(), std::mt19937(23));
+
+	indexed::set<u32> S;
+	for (auto k : Keys)
+	{
+		S.insert(k * 2);
+	}
+
+	std::vector<u32> Probes(LEN);
+	std::mt19937 gen(29);
+	for (auto& p : Probes)
+	{
+		p = gen() % (u32)(2 * LEN);
+	}
+
+	std::vector<indexed::slot> Out(LEN);
+
+	auto Run = [&](const char* name, auto&& fn)
+	{
+		size_t sum = 0;
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		fn();
+		float ms = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+		for (auto o : Out)
+		{
+			sum += o;
+		}
+
+		std::cout << name << ms << "(ms)" << ", slot sum: " << sum << std::endl;
+	};
+
+	std::cout << std::endl << "Batched lookup" << std::endl;
+
+	Run("         random, single:\t", [&]() { for (size_t i = 0; i < LEN; ++i) Out[i] = S.find_slot(Probes[i]); });
+	Run("        random, batched:\t", [&]() { S.find_slots(Probes.data(), LEN, Out.data()); });
+
+	std::sort(Probes.begin(), Probes.end());
+
+	Run("         sorted, single:\t", [&]() { for (size_t i = 0; i < LEN; ++i) Out[i] = S.find_slot(Probes[i]); });
+	Run(" sorted, path continued:\t", [&]() { S.find_slots_sorted(Probes.data(), LEN, Out.data()); });
+}
+
+
+/*
+	Lookup of 4-byte keys in the live set and in its frozen copy
+*/
+void FrozenBench(size_t LEN)
+{
+	std::vector<u32> Keys(LEN);
+	std::iota(Keys.begin(), Keys.end(), 1u);
+	std::shuffle(Keys.begin(), Keys.end(), std::mt19937(17));
+
+	indexed::set<u32> S;
+	S.insert_batch(Keys.begin(), Keys.end());
+
+	auto F = S.freeze();
+
+	std::shuffle(Keys.begin(), Keys.end(), std::mt19937(19));
+
+	float liveMs = 0, frozenMs = 0;
+	size_t liveSum = 0, frozenSum = 0;
+
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (auto k : Keys)
+		{
+			liveSum += S.find_slot(k);
+		}
+		liveMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+	}
+
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (auto k : Keys)
+		{
+			frozenSum += F.find_slot(k);
+		}
+		frozenMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+	}
+
+	float batchMs = 0;
+	size_t batchSum = 0;
+
+	std::vector<indexed::slot> Out(LEN);
+
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		F.find_slots(Keys.data(), Keys.size(), Out.data());
+		for (auto s : Out)
+		{
+			batchSum += s;
+		}
+		batchMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+	}
+
+	std::cout << std::endl << "Lookup of 4-byte keys, live vs frozen" << std::endl;
+	std::cout << "    live:\t" << liveMs << "(ms)" << ", slot sum: " << liveSum << std::endl;
+	std::cout << "  frozen:\t" << frozenMs << "(ms)" << ", slot sum: " << frozenSum << std::endl;
+	std::cout << " batched:\t" << batchMs << "(ms)" << ", slot sum: " << batchSum << std::endl;
+
+	//transparent comparator: keys of other types are compared as they are, same as by the live set
+	indexed::set<int, std::less<>> E;
+	for (int i = 0; i < 100; i += 2)
+	{
+		E.insert(i);
+	}
+
+	auto FE = E.freeze();
+
+	bool same = true;
+	for (int i = -4; i < 210; ++i)
+	{
+		same = same && E.find_slot(i / 2.0) == FE.find_slot(i / 2.0) && E.find_slot(i / 2) == FE.find_slot(i / 2);
+	}
+
+	std::cout << (same ? "Frozen slots of transparent lookup are verified" : "ERROR: frozen slots of transparent lookup differ") << std::endl;
+
+	//floating point keys up to infinity, the last block is not full, so it has padding next to the largest key
+	indexed::set<float> FS;
+	indexed::set<double> DS;
+	for (int i = 0; i < 100; ++i)
+	{
+		FS.insert(i * 0.5f);
+		DS.insert(i * 0.5);
+	}
+	FS.insert(std::numeric_limits<float>::max());
+	FS.insert(std::numeric_limits<float>::infinity());
+	DS.insert(std::numeric_limits<double>::infinity());
+
+	auto FFS = FS.freeze();
+	auto FDS = DS.freeze();
+
+	same = FFS.find_slot(std::numeric_limits<float>::infinity()) && FDS.find_slot(std::numeric_limits<double>::infinity());
+	for (int i = -2; i < 210; ++i)
+	{
+		same = same && FS.find_slot(i * 0.25f) == FFS.find_slot(i * 0.25f) && DS.find_slot(i * 0.25) == FDS.find_slot(i * 0.25);
+	}
+	FS.foreach([&](float v) { same = same && FS.find_slot(v) == FFS.find_slot(v); });
+
+	//batched lookup of blocks of many keys and of single keys
+	std::vector<double> Probes;
+	for (int i = -2; i < 210; ++i)
+	{
+		Probes.push_back(i * 0.25);
+	}
+	Probes.push_back(std::numeric_limits<double>::infinity());
+
+	std::vector<indexed::slot> POut(Probes.size()), EOut(Probes.size());
+	FDS.find_slots(Probes.data(), Probes.size(), POut.data());
+	FE.find_slots(Probes.data(), Probes.size(), EOut.data());
+
+	for (size_t i = 0; i < Probes.size(); ++i)
+	{
+		same = same && POut[i] == FDS.find_slot(Probes[i]) && EOut[i] == FE.find_slot(Probes[i]);
+	}
+
+	for (size_t i = 0; i < LEN; ++i)
+	{
+		same = same && Out[i] == S.find_slot(Keys[i]);
+	}
+
+	std::cout << (same ? "Frozen slots of floating point keys and batches are verified" : "ERROR: frozen slots of floating point keys or batches differ") << std::endl;
+}
+
+
+/*
+	Random insertion and lookup of 8-byte keys, regular nodes vs compact nodes without parent references
+*/
+template <typename Ts>
+void CompactRun(const char* name, const std::vector<uint64_t>& Keys, const std::vector<uint64_t>& Probes, size_t nodeSize)
+{
+	Ts S;
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (auto k : Keys)
+	{
+		S.insert(k);
+	}
+	float insMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+	size_t hits = 0;
+
+	t0 = std::chrono::high_resolution_clock::now();
+	for (auto k : Probes)
+	{
+		hits += S.find_slot(k) ? 1 : 0;
+	}
+	float findMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+	std::cout << name << "insert: " << insMs << "(ms)" << ", find: " << findMs << "(ms)" << ", found: " << hits
+		<< ", node memory: " << (nodeSize * S.size()) / 1024 << "(KB)" << std::endl;
+}
+
+void CompactBench(size_t LEN)
+{
+	std::vector<uint64_t> Keys(LEN);
+	std::iota(Keys.begin(), Keys.end(), (uint64_t)1);
+	std::shuffle(Keys.begin(), Keys.end(), std::mt19937(11));
+
+	std::vector<uint64_t> Probes(Keys);
+	std::shuffle(Probes.begin(), Probes.end(), std::mt19937(13));
+
+	std::cout << std::endl << "Compact nodes, 8-byte keys" << std::endl;
+
+	CompactRun<indexed::set<uint64_t>>("      inode:\t", Keys, Probes, sizeof(indexed::inode<uint64_t>));
+	CompactRun<indexed::compact_set<uint64_t>>("      cnode:\t", Keys, Probes, sizeof(indexed::cnode<uint64_t>));
+}
+
+
+/*
+	Insertion without reserve, total time and the longest single insert (dominated by reallocations)
+	for malloc'ed and mapped node memory
+*/
+template <typename Ts>
+void GrowthRun(const char* name, size_t LEN)
+{
+	Ts S;
+
+	float maxMs = 0;
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	for (u32 i = 0; i < LEN; i++)
+	{
+		auto t1 = std::chrono::high_resolution_clock::now();
+		S.append({ i, 0 });
+		maxMs = std::max(maxMs, (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t1)).count());
+	}
+
+	float totalMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+
+	std::cout << name << totalMs << "(ms)" << ", longest insert: " << maxMs << "(ms)" << ", size: " << S.size() << std::endl;
+}
+
+void GrowthBench(size_t LEN)
+{
+	std::cout << std::endl << "Growth without reserve" << std::endl;
+
+	GrowthRun<indexed::set<uint2>>("  malloc:\t", LEN);
+	GrowthRun<indexed::set<uint2, std::less<uint2>, mmap_traits>>("    mmap:\t", LEN);
+}
+
+
+/*
+	Lookup of multi-field keys by value with 'less' comparator (two calls per visited node)
+	and with three-way comparator (single call per visited node)
+*/
+void CompareBench(size_t LEN)
+{
+	std::vector<uint3> Keys;
+	Keys.reserve(LEN);
+
+	for (u32 i = 0; i < LEN; i++)
+	{
+		//keys share the first field and most of the second, so comparison has to look deep
+		Keys.push_back({ 7, i >> 4, i });
+	}
+
+	indexed::set<uint3, uint3_less>		LSet;
+	indexed::set<uint3, uint3_compare>	CSet;
+
+	LSet.assign_sorted(Keys.begin(), Keys.end());
+	CSet.assign_sorted(Keys.begin(), Keys.end());
+
+	std::shuffle(Keys.begin(), Keys.end(), std::mt19937(7));
+
+	float lessMs = 0, cmpMs = 0;
+	size_t lessHits = 0, cmpHits = 0;
+
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (const auto& k : Keys)
+		{
+			lessHits += LSet.find_slot(k) ? 1 : 0;
+		}
+		lessMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+	}
+
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (const auto& k : Keys)
+		{
+			cmpHits += CSet.find_slot(k) ? 1 : 0;
+		}
+		cmpMs = (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - t0)).count();
+	}
+
+	std::cout << std::endl << "Lookup by multi-field key" << std::endl;
+	std::cout << "       less:\t" << lessMs << "(ms)" << ", found: " << lessHits << std::endl;
+	std::cout << "  three-way:\t" << cmpMs << "(ms)" << ", found: " << cmpHits << std::endl;
 }
 
 